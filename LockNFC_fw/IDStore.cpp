@@ -9,35 +9,803 @@
 
 //#define DO_NOT_SAVE   // Use this to save Flash when debugging
 
+static inline const char* PagesFilename(uint8_t Gen) {
+    return (Gen == 0)? IDSTORE_PAGES_FILENAME0 : IDSTORE_PAGES_FILENAME1;
+}
+
+#if 1 // ================================ Index ==================================
+// Sync index entry of single ID with the groups
+void IDStore_t::IReindex(ID_t &sID) {
+    Index.Delete(sID);
+    if     (IDSecret.ContainsID(sID))  Index.Put(sID, ikSecret);
+    else if(IDAdder.ContainsID(sID))   Index.Put(sID, ikAdder);
+    else if(IDRemover.ContainsID(sID)) Index.Put(sID, ikRemover);
+}
+
+void IDStore_t::IRebuildIndex() {
+    Index.Clear();
+    for(int32_t i=0; i<IDSecret.Cnt; i++)  Index.Put(IDSecret.ID[i],  ikSecret);
+    for(int32_t i=0; i<IDAdder.Cnt; i++)   Index.Put(IDAdder.ID[i],   ikAdder);
+    for(int32_t i=0; i<IDRemover.Cnt; i++) Index.Put(IDRemover.ID[i], ikRemover);
+}
+#endif
+
+#if 1 // ============================= Bloom filter ==============================
+// Removed IDs are dropped from filter here; pages are read if Access group is not erased
+void IDStore_t::IRebuildBloom() {
+    if(SaveState == svBusy and ISnapBloom) {    // Writer thread is to rebuild it: leave it for the next one
+        BloomStaleCnt += IDBLOOM_STALE_MAX;
+        return;
+    }
+    Bloom.Clear();
+    BloomStaleCnt = 0;
+    for(int32_t i=0; i<IDSecret.Cnt; i++)  Bloom.Put(IDSecret.ID[i]);
+    for(int32_t i=0; i<IDAdder.Cnt; i++)   Bloom.Put(IDAdder.ID[i]);
+    for(int32_t i=0; i<IDRemover.Cnt; i++) Bloom.Put(IDRemover.ID[i]);
+    for(uint32_t i=0; i<Delta.Size(); i++) {
+        IdIndexSlot_t *PSlot = Delta.GetSlot(i);
+        if(PSlot->Kind == ikAccess) Bloom.Put(PSlot->ID);
+    }
+    if(!AccessErased) {
+        for(uint32_t n=0; n<IPageCnt[IGen]; n++) {
+            IdPage_t *PPage = IGetPage(n);
+            if(PPage == nullptr) continue;
+            for(uint32_t i=0; i<PPage->Cnt; i++) {
+                if(Delta.Get(PPage->ID[i]) != ikDeleted) Bloom.Put(PPage->ID[i]);
+            }
+        }
+    }
+    BloomReady = true;
+}
+
+// IdStore thread: filter is built again over the base just written; Check does not use it
+// until ITakeBloom. Pages are read here, so App thread does not wait for the card to drop removed IDs.
+// Puts of App thread made meanwhile may be lost, ITakeBloom repeats them.
+void IDStore_t::IBuildBloom() {
+    chSysLock();
+    BloomReady = false;
+    chSysUnlock();
+    Bloom.Clear();
+    for(uint32_t i=0; i<Image.IDCnt(); i++) Bloom.Put(Image.ID[i]);
+    uint8_t AGen = Image.Hdr.PageGen;
+    if(IPageCnt[AGen] == 0) return;
+    if(f_open(&IFile, PagesFilename(AGen), FA_READ+FA_OPEN_EXISTING) != FR_OK) {
+        ISnapBloom = false;
+        return;
+    }
+    for(uint32_t n=0; n<IPageCnt[AGen]; n++) {
+        if(IReadPage(&IFile, &ISrcPage) != OK) {
+            ISnapBloom = false;     // App thread rebuilds it
+            break;
+        }
+        for(uint32_t i=0; i<ISrcPage.Cnt; i++) Bloom.Put(ISrcPage.ID[i]);
+    }
+    f_close(&IFile);
+}
+
+// Filter built by writer thread knows nothing of changes made after snapshot: add them.
+// IDs removed after snapshot stay in filter until next rebuild.
+void IDStore_t::ITakeBloom() {
+    if(!ISnapBloom) {
+        if(!BloomReady and PThd != nullptr) IRebuildBloom();    // Rebuild by writer thread failed; at boot, Load builds it
+        return;
+    }
+    BloomStaleCnt = (BloomStaleCnt > ISnapStaleCnt)? (BloomStaleCnt - ISnapStaleCnt) : 0;
+    for(uint32_t i=0; i<Delta.Size(); i++) {
+        IdIndexSlot_t *PSlot = Delta.GetSlot(i);
+        if(PSlot->Kind == ikAccess) Bloom.Put(PSlot->ID);
+    }
+    for(int32_t i=0; i<IDSecret.Cnt; i++)  Bloom.Put(IDSecret.ID[i]);
+    for(int32_t i=0; i<IDAdder.Cnt; i++)   Bloom.Put(IDAdder.ID[i]);
+    for(int32_t i=0; i<IDRemover.Cnt; i++) Bloom.Put(IDRemover.ID[i]);
+    BloomReady = true;
+    PrintBloomStats();
+}
+
+void IDStore_t::PrintBloomStats() {
+    uint32_t Fpr = Bloom.EstimateFpr();
+    Uart.Printf("Bloom: %u bytes, %u IDs, FP est %u.%02u%%; checks %u, rejected %u, false positive %u\r",
+            IDBLOOM_SZ_BYTES, Bloom.Cnt, Fpr / 100, Fpr % 100, CheckCnt, RejectCnt, FalsePositiveCnt);
+}
+#endif
+
 IdKind_t IDStore_t::Check(ID_t &sID, int32_t *PIndx) {
-    if     (IDSecret.ContainsID(sID, PIndx))  return ikSecret;
-    else if(IDAccess.ContainsID(sID, PIndx))  return ikAccess;
-    else if(IDAdder.ContainsID(sID, PIndx))   return ikAdder;
-    else if(IDRemover.ContainsID(sID, PIndx)) return ikRemover;
-    else return ikNone;
+    IApplySaved();
+    CheckCnt++;
+    chSysLock();
+    bool Unknown = BloomReady and !Bloom.MayContain(sID);   // Not used while writer thread rebuilds it
+    chSysUnlock();
+    if(Unknown) {   // Surely unknown
+        RejectCnt++;
+        return ikNone;
+    }
+    IdKind_t Kind = Index.Get(sID);
+    if(Kind != ikSecret and IHasAccess(sID, PIndx)) return ikAccess;
+    if(Kind == ikNone) FalsePositiveCnt++;
+    if(PIndx != nullptr) {  // Index within the group is required
+        switch(Kind) {
+            case ikSecret:  IDSecret.ContainsID(sID, PIndx);  break;
+            case ikAdder:   IDAdder.ContainsID(sID, PIndx);   break;
+            case ikRemover: IDRemover.ContainsID(sID, PIndx); break;
+            default: break;
+        }
+    }
+    return Kind;
+}
+
+#if 1 // ============================= Batch edits ===============================
+// Journal records would overflow the queue, so whole base is saved instead
+#define IDSTORE_BATCH_JOURNAL_MAX   (IDSTORE_QUEUE_SZ / 2)
+
+// Shell sort by ID: no recursion, and delta snapshot is sorted here too
+static void SortSlots(IdIndexSlot_t *PSlot, uint32_t Cnt) {
+    uint32_t Gap = 1;
+    while(Gap < Cnt / 3) Gap = Gap * 3 + 1;
+    for(; Gap > 0; Gap /= 3) {
+        for(uint32_t i=Gap; i<Cnt; i++) {
+            IdIndexSlot_t Slot = PSlot[i];
+            uint32_t j = i;
+            for(; j>=Gap and Slot.ID < PSlot[j-Gap].ID; j-=Gap) PSlot[j] = PSlot[j-Gap];
+            PSlot[j] = Slot;
+        }
+    }
+}
+
+// Batch entry supersedes delta entry of the same ID. At boot, full batch is merged at once.
+void IDStore_t::IBatchPut(ID_t &sID, IdKind_t Kind) {
+    if(IBatchCnt == ID_BATCH_MAX_CNT) {
+        IBatchSeal();
+        ICompactNow();
+    }
+    Delta.Delete(sID);
+    IBatch[IBatchCnt].ID = sID;
+    IBatch[IBatchCnt].Kind = Kind;
+    IBatchCnt++;
+    if(Kind == ikAccess) Bloom.Put(sID);
+    else BloomStaleCnt++;
+}
+
+// Sorted once; repeated IDs are dropped, the last one is kept
+void IDStore_t::IBatchSeal() {
+    SortSlots(IBatch, IBatchCnt);
+    uint32_t N = 0;
+    for(uint32_t i=0; i<IBatchCnt; i++) {
+        if(N != 0 and IBatch[N-1].ID == IBatch[i].ID) IBatch[N-1] = IBatch[i];
+        else IBatch[N++] = IBatch[i];
+    }
+    IBatchCnt = N;
+}
+
+// Binary search; returns index of ID or -1
+int32_t IDStore_t::IFindInBatch(ID_t &sID) {
+    int32_t Lo = 0, Hi = IBatchCnt - 1;
+    while(Lo <= Hi) {
+        int32_t Mid = (Lo + Hi) / 2;
+        if(IBatch[Mid].ID == sID) return Mid;
+        if(IBatch[Mid].ID < sID) Lo = Mid + 1;
+        else Hi = Mid - 1;
+    }
+    return -1;
+}
+
+// No page is read here: presence of every ID is resolved by merge
+uint8_t IDStore_t::IAccessBatch(ID_t *PID, uint32_t ACnt, IdKind_t Kind) {
+    if(PThd != nullptr) {
+        IApplySaved();
+        if(IBatchCnt != 0 or SaveState != svIdle) {
+            Uart.Printf("IDs: busy\r");
+            return FAILURE;
+        }
+        if(ACnt > ID_BATCH_MAX_CNT) {
+            Uart.Printf("IDs: batch too long\r");
+            return FAILURE;
+        }
+    }
+    for(uint32_t n=0; n<ACnt; n++) IBatchPut(PID[n], Kind);
+    IBatchSeal();
+    if(PThd == nullptr) return ICompactNow();
+    Save();     // Batch stays in RAM until it is written, so failure here is retried later
+    return OK;
+}
+
+uint8_t IDStore_t::AddMany(ID_t *PID, uint32_t ACnt, IdKind_t Kind) {
+    if(Kind == ikAccess) return IAccessBatch(PID, ACnt, ikAccess);
+    if(Kind != ikAdder and Kind != ikRemover) return FAILURE;
+    // New IDs are appended to group, so only they are indexed and journaled
+    ID_t *PNew;
+    int32_t Cnt0, Cnt1;
+    uint8_t Rslt;
+    if(Kind == ikAdder) {
+        Cnt0 = IDAdder.Cnt;
+        Rslt = IDAdder.AddMany(PID, ACnt);
+        Cnt1 = IDAdder.Cnt;
+        PNew = IDAdder.ID;
+    }
+    else {
+        Cnt0 = IDRemover.Cnt;
+        Rslt = IDRemover.AddMany(PID, ACnt);
+        Cnt1 = IDRemover.Cnt;
+        PNew = IDRemover.ID;
+    }
+    bool DoJournal = ((Cnt1 - Cnt0) <= IDSTORE_BATCH_JOURNAL_MAX);
+    for(int32_t i=Cnt0; i<Cnt1; i++) {
+        Index.Put(PNew[i], Kind);
+        Bloom.Put(PNew[i]);
+        if(DoJournal) IJournal(jopAdd, Kind, &PNew[i]);
+    }
+    if(!DoJournal) HasChanged = true;
+    return Rslt;
+}
+
+uint8_t IDStore_t::RemoveMany(ID_t *PID, uint32_t ACnt, IdKind_t Kind) {
+    if(Kind == ikAccess) return IAccessBatch(PID, ACnt, ikDeleted);
+    if(Kind != ikAdder and Kind != ikRemover) return FAILURE;
+    // Absent IDs are neither journaled nor counted as stale
+    uint32_t Cnt = 0;
+    for(uint32_t n=0; n<ACnt; n++) {
+        if(Kind == ikAdder? IDAdder.ContainsID(PID[n]) : IDRemover.ContainsID(PID[n])) Cnt++;
+    }
+    bool DoJournal = (Cnt <= IDSTORE_BATCH_JOURNAL_MAX);
+    for(uint32_t n=0; n<ACnt and DoJournal; n++) {
+        if(Kind == ikAdder? IDAdder.ContainsID(PID[n]) : IDRemover.ContainsID(PID[n])) IJournal(jopRemove, Kind, &PID[n]);
+    }
+    uint8_t Rslt = (Kind == ikAdder)? IDAdder.RemoveMany(PID, ACnt) : IDRemover.RemoveMany(PID, ACnt);
+    IRebuildIndex();    // Small groups: cheaper than reindexing every ID
+    BloomStaleCnt += Cnt;
+    if(!DoJournal) HasChanged = true;
+    return Rslt;
+}
+#endif
+
+#if 1 // ============================= Access pages ==============================
+// Called when page file is changed and writer thread is not merging; cache is invalidated
+void IDStore_t::IOpenPages() {
+    f_close(&IPageFile);
+    for(uint32_t i=0; i<IDPAGE_CACHE_CNT; i++) ICachedN[i] = -1;
+    ICacheNext = 0;
+    if(IPageCnt[IGen] == 0) return;
+    if(f_open(&IPageFile, PagesFilename(IGen), FA_READ+FA_OPEN_EXISTING) != FR_OK) {
+        Uart.Printf("IDs: no pages\r");
+        IPageCnt[IGen] = 0;
+        return;
+    }
+    // Seek within file without reading FAT. Fragmented file is read in usual way.
+    IClmt[0] = IDPAGE_CLMT_SZ;
+    IPageFile.cltbl = IClmt;
+    if(f_lseek(&IPageFile, CREATE_LINKMAP) != FR_OK) IPageFile.cltbl = nullptr;
 }
 
+// Reads page at current position of file and checks it
+uint8_t IDStore_t::IReadPage(FIL *PFile, IdPage_t *PPage) {
+    UINT Done = 0;
+    if(f_read(PFile, PPage, sizeof(IdPage_t), &Done) != FR_OK or Done != sizeof(IdPage_t) or
+       PPage->Cnt > IDPAGE_ID_CNT or PPage->Crc != PPage->CalcCrc()) return FAILURE;
+    return OK;
+}
+
+// Page N of current file. IPageFile is shared with writer thread, so seek and read go together.
+uint8_t IDStore_t::IReadPageAt(uint32_t N, IdPage_t *PPage) {
+    chSemWait(&IPageLock);
+    uint8_t Rslt = (f_lseek(&IPageFile, N * sizeof(IdPage_t)) == FR_OK)? IReadPage(&IPageFile, PPage) : FAILURE;
+    chSemSignal(&IPageLock);
+    return Rslt;
+}
+
+// Page is read from cache or with single sector read
+IdPage_t* IDStore_t::IGetPage(uint32_t N) {
+    for(uint32_t i=0; i<IDPAGE_CACHE_CNT; i++) {
+        if(ICachedN[i] == (int32_t)N) return &ICache[i];
+    }
+    IdPage_t *PPage = &ICache[ICacheNext];
+    ICachedN[ICacheNext] = -1;
+    if(IReadPageAt(N, PPage) != OK) {
+        Uart.Printf("IDs: bad page %u\r", N);
+        return nullptr;
+    }
+    ICachedN[ICacheNext] = N;
+    if(++ICacheNext == IDPAGE_CACHE_CNT) ICacheNext = 0;
+    return PPage;
+}
+
+bool IDStore_t::IFindInPages(ID_t &sID, int32_t *PIndx) {
+    uint32_t Cnt = IPageCnt[IGen];
+    IdFence_t *PFence = IFence[IGen];
+    if(Cnt == 0 or sID < PFence[0].MinID) return false;
+    // Find last page starting not after the ID
+    uint32_t Lo = 0, Hi = Cnt - 1;
+    while(Lo < Hi) {
+        uint32_t Mid = (Lo + Hi + 1) / 2;
+        if(sID < PFence[Mid].MinID) Hi = Mid - 1;
+        else Lo = Mid;
+    }
+    IdPage_t *PPage = IGetPage(Lo);
+    if(PPage == nullptr) return false;
+    int32_t i = PPage->Find(sID);
+    if(i < 0) return false;
+    if(PIndx != nullptr) {
+        for(uint32_t n=0; n<Lo; n++) i += PFence[n].Cnt;
+        *PIndx = i;
+    }
+    return true;
+}
+#endif
+
+#if 1 // ============================= Access delta ==============================
+bool IDStore_t::IHasAccess(ID_t &sID, int32_t *PIndx) {
+    IdKind_t Kind = Delta.Get(sID);
+    if(Kind == ikAccess) {
+        if(PIndx != nullptr) *PIndx = -1;   // Not in pages yet
+        return true;
+    }
+    if(Kind == ikDeleted or AccessErased) return false;
+    if(IBatchCnt != 0) {    // Batch is not merged into pages yet
+        int32_t i = IFindInBatch(sID);
+        if(i >= 0) {
+            if(IBatch[i].Kind != ikAccess) return false;
+            if(PIndx != nullptr) *PIndx = -1;
+            return true;
+        }
+    }
+    return IFindInPages(sID, PIndx);
+}
+
+// Delta must have room for new entry. Writer thread folds it into pages long before it is full.
+uint8_t IDStore_t::IDeltaRoom(ID_t &sID) {
+    if(Delta.Get(sID) != ikNone or Delta.Cnt < ID_DELTA_MAX_CNT) return OK;
+    if(PThd == nullptr) return ICompactNow();   // At boot, delta is folded into pages at once
+    IApplySaved();                              // Compaction may be done already
+    if(Delta.Cnt < ID_DELTA_MAX_CNT) return OK;
+    Uart.Printf("\rIDs: delta full");
+    Save();
+    return FAILURE;
+}
+
+// Compaction is started as soon as delta grows long, not at idle state only
+void IDStore_t::IDeltaGrown() {
+    if(PThd == nullptr or Delta.Cnt <= ID_DELTA_COMPACT_CNT) return;
+    IApplySaved();
+    Save();     // Does nothing if previous one is being written
+}
+
+uint8_t IDStore_t::IAddAccess(ID_t &sID) {
+    if(IHasAccess(sID, nullptr)) {
+        Uart.Printf("\rAlready in base");
+        return OK;
+    }
+    else if(AccessCnt >= ID_ACCESS_CNT) {
+        Uart.Printf("\rBase overflow");
+        return FAILURE;
+    }
+    if(IDeltaRoom(sID) != OK) return FAILURE;
+    Delta.Set(sID, ikAccess);
+    AccessCnt++;
+    IDeltaGrown();
+    return OK;
+}
+
+uint8_t IDStore_t::IRemoveAccess(ID_t &sID) {
+    if(!IHasAccess(sID, nullptr)) {
+        Uart.Printf("\rNo such ID");
+        return FAILURE;
+    }
+    if(IDeltaRoom(sID) != OK) return FAILURE;
+    Delta.Set(sID, ikDeleted);
+    AccessCnt--;
+    Uart.Printf("\rID removed, count = %u\r", AccessCnt);
+    IDeltaGrown();
+    return OK;
+}
+#endif
+
+#if 1 // ============================== Compaction ===============================
+// Reads current pages in order and merges them with sorted batch and delta snapshot into next page file.
+// Current pages are read through IPageFile of App thread, so IFile is the only file of writer thread.
+uint8_t IDStore_t::IMergePages() {
+    uint8_t DstGen = IGen ^ 1;
+    uint32_t SrcCnt = ISnapErased? 0 : IPageCnt[IGen];
+    uint32_t SrcN = 0, SrcI = 0, BatchI = 0, DeltaI = 0, DstCnt = 0;
+    if(f_open(&IFile, PagesFilename(DstGen), FA_WRITE+FA_CREATE_ALWAYS) != FR_OK) return FAILURE;
+    uint8_t Rslt = OK;
+    ISrcPage.Cnt = 0;
+    IDstPage.Cnt = 0;
+    IDstPage.Reserved = 0;
+    while(Rslt == OK) {
+        if(SrcI >= ISrcPage.Cnt and SrcN < SrcCnt) {
+            SrcI = 0;
+            SrcN++;
+            if(IReadPageAt(SrcN-1, &ISrcPage) != OK) {
+                Uart.Printf("IDs: bad page %u\r", SrcN-1);   // Skip it, it cannot be read anyway
+                ISrcPage.Cnt = 0;
+            }
+            continue;
+        }
+        bool HasSrc = (SrcI < ISrcPage.Cnt), HasBatch = (BatchI < ISnapBatchCnt), HasDelta = (DeltaI < ISnapDeltaCnt);
+        // Smallest ID of three sources; on equal IDs, newer source wins: delta, then batch, then page
+        ID_t *PID = nullptr;
+        uint8_t Kind = ikAccess;
+        if(HasSrc) PID = &ISrcPage.ID[SrcI];
+        if(HasBatch and (PID == nullptr or !(*PID < IBatch[BatchI].ID))) {
+            PID = &IBatch[BatchI].ID;
+            Kind = IBatch[BatchI].Kind;
+        }
+        if(HasDelta and (PID == nullptr or !(*PID < ISnapDelta[DeltaI].ID))) {
+            PID = &ISnapDelta[DeltaI].ID;
+            Kind = ISnapDelta[DeltaI].Kind;
+        }
+        if(PID == nullptr) break;
+        // The same ID is taken from all the sources at once
+        if(HasSrc and ISrcPage.ID[SrcI] == *PID) SrcI++;
+        if(HasBatch and IBatch[BatchI].ID == *PID) BatchI++;
+        if(HasDelta and ISnapDelta[DeltaI].ID == *PID) DeltaI++;
+        if(Kind != ikAccess) continue;
+        if(DstCnt == IDPAGE_MAX_CNT) {
+            Uart.Printf("\rBase overflow");
+            break;
+        }
+        IDstPage.ID[IDstPage.Cnt++] = *PID;
+        if(IDstPage.Cnt == IDPAGE_ID_CNT) Rslt = IFlushPage(&DstCnt);
+    }
+    if(Rslt == OK and IDstPage.Cnt != 0) Rslt = IFlushPage(&DstCnt);
+    if(Rslt == OK and f_sync(&IFile) != FR_OK) Rslt = FAILURE;
+    f_close(&IFile);
+    IPageCnt[DstGen] = DstCnt;
+    return Rslt;
+}
+
+uint8_t IDStore_t::IFlushPage(uint32_t *PCnt) {
+    IDstPage.Crc = IDstPage.CalcCrc();
+    IdFence_t *PFence = &IFence[IGen ^ 1][*PCnt];
+    PFence->MinID = IDstPage.ID[0];
+    PFence->Cnt = IDstPage.Cnt;
+    UINT Done = 0;
+    if(f_write(&IFile, &IDstPage, sizeof(IdPage_t), &Done) != FR_OK or Done != sizeof(IdPage_t)) return FAILURE;
+    (*PCnt)++;
+    IDstPage.Cnt = 0;
+    return OK;
+}
+
+// New page file is complete: make it current
+void IDStore_t::ISwitchPages() {
+    if(Image.Hdr.PageGen != IGen) {
+        IGen = Image.Hdr.PageGen;
+        IOpenPages();
+    }
+    if(IErasedAfterSnap) {          // Delta is newer than pages
+        ITakeBloom();
+        return;
+    }
+    AccessErased = false;
+    IBatchCnt = 0;                  // New batch is not accepted until this one is in pages
+    // Delta entries which got into page file are not needed any more
+    for(uint32_t i=0; i<ISnapDeltaCnt; i++) {
+        if(Delta.Get(ISnapDelta[i].ID) == ISnapDelta[i].Kind) Delta.Delete(ISnapDelta[i].ID);
+    }
+    // Batch was merged without lookups, so count is taken from pages. Remaining delta
+    // entries are changes made against them: added ones were absent, removed ones were present.
+    AccessCnt = 0;
+    for(uint32_t i=0; i<IPageCnt[IGen]; i++) AccessCnt += IFence[IGen][i].Cnt;
+    for(uint32_t i=0; i<Delta.Size(); i++) {
+        IdIndexSlot_t *PSlot = Delta.GetSlot(i);
+        if(PSlot->Kind == ikAccess) AccessCnt++;
+        else if(PSlot->Kind == ikDeleted) AccessCnt--;
+    }
+    ITakeBloom();
+}
+
+// Called by App thread: page file written by IdStore thread is taken into use
+void IDStore_t::IApplySaved() {
+    if(SaveState == svDone) {
+        ISwitchPages();
+        SaveState = svIdle;
+    }
+    else if(SaveState == svFailed) {
+        SaveState = svIdle;
+        HasChanged = true;  // Try again
+    }
+}
+
+// At boot only, when writer thread is not started yet
+uint8_t IDStore_t::ICompactNow() {
+    IBuildImage();
+    if(IWriteBase() != OK) return FAILURE;
+    ISwitchPages();
+    return OK;
+}
+#endif
+
 // =============================== Load/save ===================================
+// Thread
+static WORKING_AREA(waIdStoreThread, 512);
+__attribute__ ((__noreturn__))
+static void IdStoreThread(void *arg) {
+    chRegSetThreadName("IdStore");
+    ((IDStore_t*)arg)->ITask();
+}
+
+void IDStore_t::Init() {
+    Load();
+    chSemInit(&IBusy, 1);
+    PThd = chThdCreateStatic(waIdStoreThread, sizeof(waIdStoreThread), LOWPRIO, (tfunc_t)IdStoreThread, this);
+}
+
+// Called at boot only, when writer thread is not started yet
 void IDStore_t::Load() {
+    chSemInit(&IPageLock, 1);
+    BloomReady = false;
+    ISnapBloom = false;
     HasChanged = false;
-    if(SD.OpenRead(IDSTORE_FILENAME) == OK) {
-        IDAccess.Load(ID_GROUP_NAME_ACCESS);
-        IDAdder.Load(ID_GROUP_NAME_ADDER);
-        IDRemover.Load(ID_GROUP_NAME_REMOVER);
-        IDSecret.Load(ID_GROUP_NAME_SECRET);
-        SD.Close();
-        Uart.Printf("IDs loaded\r");
+    JournalCnt = 0;
+    SaveState = svIdle;
+    Delta.Clear();
+    IBatchCnt = 0;
+    AccessErased = false;
+    IGen = 0;
+    IPageCnt[0] = 0;
+    IPageCnt[1] = 0;
+    // Text file put on the card replaces the base
+    FILINFO FInfo;
+    FInfo.lfname = nullptr;
+    FInfo.lfsize = 0;
+    if(f_stat(IDSTORE_INI_FILENAME, &FInfo) == FR_OK and IImportIni() == OK) {
+        f_unlink(IDSTORE_JOURNAL_FILENAME);
+        f_unlink(IDSTORE_INI_IMPORTED);
+        f_rename(IDSTORE_INI_FILENAME, IDSTORE_INI_IMPORTED);
+        Uart.Printf("IDs imported\r");
+    }
+    else {
+        if(ILoadBin(IDSTORE_FILENAME) == OK) Uart.Printf("IDs loaded\r");
+        // Power was lost between removing old base and renaming new one
+        else if(ILoadBin(IDSTORE_TMP_FILENAME) == OK) {
+            f_rename(IDSTORE_TMP_FILENAME, IDSTORE_FILENAME);
+            Uart.Printf("IDs restored\r");
+        }
+        else {  // Base may be absent if nothing was compacted yet
+            IDAdder.Erase();
+            IDRemover.Erase();
+            IDSecret.Erase();
+            IGen = 0;
+            IPageCnt[0] = 0;
+        }
+        IOpenPages();
+        AccessCnt = 0;
+        for(uint32_t i=0; i<IPageCnt[IGen]; i++) AccessCnt += IFence[IGen][i].Cnt;
+        IReplayJournal();
     }
+    IRebuildIndex();
+    IRebuildBloom();
+    PrintBloomStats();
 }
 
-void IDStore_t::Save(void) {
+uint8_t IDStore_t::ILoadBin(const char *AFilename) {
+    if(f_open(&IFile, AFilename, FA_READ+FA_OPEN_EXISTING) != FR_OK) return FAILURE;
+    uint8_t Rslt = FAILURE;
+    IdStoreHdr_t &Hdr = Image.Hdr;
+    UINT Done = 0;
+    if(f_read(&IFile, &Hdr, sizeof(Hdr), &Done) != FR_OK or Done != sizeof(Hdr)) Uart.Printf("%S: read error\r", AFilename);
+    else if(Hdr.Signature != IDSTORE_SIGNATURE or Hdr.Version != IDSTORE_VERSION or
+       Hdr.CntAdder > ID_ADDER_CNT or Hdr.CntRemover > ID_REMOVER_CNT or Hdr.CntSecret > ID_SECRET_CNT or
+       Hdr.PageCnt > IDPAGE_MAX_CNT or Hdr.PageGen > 1) Uart.Printf("%S: bad format\r", AFilename);
+    else {
+        IdFence_t *PFence = IFence[Hdr.PageGen];
+        UINT Len = Image.IDCnt() * ID_SZ_BYTES, FenceLen = Hdr.PageCnt * sizeof(IdFence_t), FenceDone = 0;
+        if(f_read(&IFile, Image.ID, Len, &Done) != FR_OK or Done != Len or
+           f_read(&IFile, PFence, FenceLen, &FenceDone) != FR_OK or FenceDone != FenceLen) Uart.Printf("%S: read error\r", AFilename);
+        else if(Hdr.Crc != Image.CalcCrc(PFence)) Uart.Printf("%S: bad CRC\r", AFilename);
+        else Rslt = OK;
+    }
+    f_close(&IFile);
+    if(Rslt != OK) return FAILURE;
+    ID_t *p = Image.ID;
+    p = IDAdder.CopyFrom(p, Hdr.CntAdder);
+    p = IDRemover.CopyFrom(p, Hdr.CntRemover);
+    IDSecret.CopyFrom(p, Hdr.CntSecret);
+    IGen = Hdr.PageGen;
+    IPageCnt[IGen] = Hdr.PageCnt;
+    return OK;
+}
+
+// Access IDs are collected into batch, which is merged into pages whenever it is full
+void IDStore_t::IIniAccessHandler(void *PContext, const char *AKey, char *AValue) {
+    IDStore_t *PStore = (IDStore_t*)PContext;
+    if(strncmp(AKey, "ID", 2) != 0) return;
+    ID_t ID;
+    if(iniFile_t::StrToArray(AValue, ID.ID8, ID_SZ_BYTES) == OK) PStore->IBatchPut(ID, ikAccess);
+}
+
+uint8_t IDStore_t::IImportIni() {
+    if(SD.OpenRead(IDSTORE_INI_FILENAME) != OK) return FAILURE;
+    const IniHandler_t Handlers[] = {
+            {ID_GROUP_NAME_ACCESS,  IIniAccessHandler,                      this},
+            {ID_GROUP_NAME_ADDER,   ID_Array_t<ID_ADDER_CNT>::IniHandler,   &IDAdder},
+            {ID_GROUP_NAME_REMOVER, ID_Array_t<ID_REMOVER_CNT>::IniHandler, &IDRemover},
+            {ID_GROUP_NAME_SECRET,  ID_Array_t<ID_SECRET_CNT>::IniHandler,  &IDSecret},
+    };
+    IEraseAll();
+    IDSecret.Erase();
+    systime_t Start = chTimeNow();
+    uint8_t Rslt = SD.iniFile.Parse(Handlers, countof(Handlers));
+    SD.Close();
+    IBatchSeal();
+    if(Rslt == OK) Rslt = ICompactNow();
+    Uart.Printf("IDs: %u parsed in %u ms\r", (AccessCnt + IDAdder.Cnt + IDRemover.Cnt + IDSecret.Cnt), (chTimeNow() - Start));
+    return Rslt;
+}
+
+// Snapshot of small groups and Access delta, written by IdStore thread
+void IDStore_t::IBuildImage() {
+    IdStoreHdr_t &Hdr = Image.Hdr;
+    Hdr.Signature  = IDSTORE_SIGNATURE;
+    Hdr.Version    = IDSTORE_VERSION;
+    Hdr.CntAdder   = IDAdder.Cnt;
+    Hdr.CntRemover = IDRemover.Cnt;
+    Hdr.CntSecret  = IDSecret.Cnt;
+    Hdr.Reserved   = 0;
+    ID_t *p = Image.ID;
+    p = IDAdder.CopyTo(p);
+    p = IDRemover.CopyTo(p);
+    IDSecret.CopyTo(p);
+    // Delta is sorted to be merged with pages
+    ISnapDeltaCnt = Delta.CopyTo(ISnapDelta);
+    SortSlots(ISnapDelta, ISnapDeltaCnt);
+    ISnapBatchCnt = IBatchCnt;      // Sorted already
+    ISnapErased = AccessErased;
+    IErasedAfterSnap = false;
+    ISnapBloom = false;
+}
+
+// Does not block: snapshot is taken here and written by IdStore thread
+void IDStore_t::Save() {
+    if(SaveState != svIdle) return;   // Previous one is being written, HasChanged will bring us here again
+    IBuildImage();
+    // Filter with many removed IDs is rebuilt over new base by writer thread
+    ISnapStaleCnt = BloomStaleCnt;
+    ISnapBloom = (BloomStaleCnt > IDBLOOM_STALE_MAX);
+    SaveState = svBusy;
     HasChanged = false;
-    if(SD.OpenRewrite(IDSTORE_FILENAME) == OK) {
-        IDAccess.Save(ID_GROUP_NAME_ACCESS);
-        IDAdder.Save(ID_GROUP_NAME_ADDER);
-        IDRemover.Save(ID_GROUP_NAME_REMOVER);
-        IDSecret.Save(ID_GROUP_NAME_SECRET);
-        SD.Close();
-        Uart.Printf("IDs saved\r");
+    // Journal will be removed after snapshot is written, new records will start new one
+    IdJournalRec_t Rec;
+    Rec.Op = jopSnapshot;
+    if(IPost(&Rec) == OK) JournalCnt = 0;
+    else {
+        SaveState = svIdle;
+        HasChanged = true;
     }
 }
+
+void IDStore_t::CompactIfNeeded() {
+    IApplySaved();
+    if(HasChanged or JournalCnt > IDSTORE_JOURNAL_MAX_CNT or Delta.Cnt > ID_DELTA_COMPACT_CNT) Save();
+}
+
+// Pages are rewritten only if Access group has changed
+uint8_t IDStore_t::IWriteBase() {
+    if(ISnapDeltaCnt == 0 and ISnapBatchCnt == 0 and !ISnapErased) return IWriteImage(IGen);
+    if(IMergePages() != OK) {
+        Uart.Printf("IDs: pages write error\r");
+        return FAILURE;
+    }
+    return IWriteImage(IGen ^ 1);
+}
+
+// Old base is kept until new one is completely written
+uint8_t IDStore_t::IWriteImage(uint8_t AGen) {
+    IdStoreHdr_t &Hdr = Image.Hdr;
+    IdFence_t *PFence = IFence[AGen];
+    Hdr.PageGen = AGen;
+    Hdr.PageCnt = IPageCnt[AGen];
+    Hdr.Crc = Image.CalcCrc(PFence);
+    uint8_t Rslt = FAILURE;
+    if(f_open(&IFile, IDSTORE_TMP_FILENAME, FA_WRITE+FA_CREATE_ALWAYS) == FR_OK) {
+        UINT Len = Image.Size(), FenceLen = Hdr.PageCnt * sizeof(IdFence_t), Done = 0, FenceDone = 0;
+        if(f_write(&IFile, &Image, Len, &Done) == FR_OK and Done == Len and
+           f_write(&IFile, PFence, FenceLen, &FenceDone) == FR_OK and FenceDone == FenceLen and
+           f_sync(&IFile) == FR_OK) Rslt = OK;
+        f_close(&IFile);
+    }
+    if(Rslt == OK) {
+        f_unlink(IDSTORE_FILENAME); // f_rename does not overwrite existing file
+        if(f_rename(IDSTORE_TMP_FILENAME, IDSTORE_FILENAME) != FR_OK) Rslt = FAILURE;
+    }
+    if(Rslt == OK) Uart.Printf("IDs saved\r");
+    else Uart.Printf("IDs: write error\r");
+    return Rslt;
+}
+
+// =============================== Journal =====================================
+uint8_t IDStore_t::IPost(IdJournalRec_t *PRec) {
+    chSysLock();
+    uint8_t Rslt = Queue.Put(PRec);
+    if(Rslt == OK) chEvtSignalI(PThd, IDSTORE_EVT_NEW);
+    chSysUnlock();
+    return Rslt;
+}
+
+void IDStore_t::IJournal(IdJournalOp_t Op, IdKind_t Kind, ID_t *PID) {
+    IdJournalRec_t Rec;
+    Rec.Op = Op;
+    Rec.Kind = Kind;
+    if(PID != nullptr) Rec.ID = *PID;
+    else Rec.ID.ID32[0] = Rec.ID.ID32[1] = 0;
+    Rec.Check = Rec.CalcCheck();
+    if(IPost(&Rec) == OK) JournalCnt++;
+    else {
+        HasChanged = true;  // Save whole base instead
+        Uart.Printf("IDs: queue overflow\r");
+    }
+}
+
+uint8_t IDStore_t::IAppendJournal(IdJournalRec_t *PRec) {
+    UINT Done = 0;
+    if(f_open(&IFile, IDSTORE_JOURNAL_FILENAME, FA_WRITE+FA_OPEN_ALWAYS) == FR_OK) {
+        // Append after last whole record, overwriting torn one if any
+        DWORD Pos = (IFile.fsize / sizeof(IdJournalRec_t)) * sizeof(IdJournalRec_t);
+        if(f_lseek(&IFile, Pos) == FR_OK) f_write(&IFile, PRec, sizeof(IdJournalRec_t), &Done);
+        f_close(&IFile);
+    }
+    return (Done == sizeof(IdJournalRec_t))? OK : FAILURE;
+}
+
+// Apply recorded changes to groups. Index is rebuilt by caller.
+// IFile may be needed for compaction when delta gets full, so common file is used.
+void IDStore_t::IReplayJournal() {
+    JournalCnt = 0;
+    if(f_open(&SD.File, IDSTORE_JOURNAL_FILENAME, FA_READ+FA_OPEN_EXISTING) != FR_OK) return;
+    IdJournalRec_t Rec;
+    UINT Done = 0;
+    while(f_read(&SD.File, &Rec, sizeof(Rec), &Done) == FR_OK and Done == sizeof(Rec)) {
+        JournalCnt++;
+        if(Rec.Check != Rec.CalcCheck()) continue;  // Damaged record
+        switch(Rec.Op) {
+            case jopAdd:      IAdd(Rec.ID, (IdKind_t)Rec.Kind);    break;
+            case jopRemove:   IRemove(Rec.ID, (IdKind_t)Rec.Kind); break;
+            case jopEraseAll: IEraseAll(); break;
+            default: break;
+        }
+    }
+    f_close(&SD.File);
+    if(JournalCnt != 0) Uart.Printf("IDs: %u changes replayed\r", JournalCnt);
+}
+
+// ================================ Thread =====================================
+// Writes journal records and snapshots in order they were posted
+__attribute__ ((__noreturn__))
+void IDStore_t::ITask() {
+    while(true) {
+        chEvtWaitAny(IDSTORE_EVT_NEW);
+        IdJournalRec_t Rec;
+        while(true) {
+            chSysLock();
+            uint8_t r = Queue.Get(&Rec);
+            chSysUnlock();
+            if(r != OK) break;
+            chSemWait(&IBusy);
+            if(Rec.Op == jopSnapshot) {
+                if(IWriteBase() == OK) {
+                    if(ISnapBloom) IBuildBloom();
+                    // Everything is in base now, journal is not needed
+                    f_unlink(IDSTORE_JOURNAL_FILENAME);
+                    SaveState = svDone;
+                }
+                else SaveState = svFailed;
+            }
+            else if(IAppendJournal(&Rec) != OK) {
+                HasChanged = true;
+                Uart.Printf("IDs: journal error\r");
+            }
+            chSemSignal(&IBusy);
+        }
+    } // while true
+}
+
+// Called by App thread. Records posted meanwhile are written after Resume.
+void IDStore_t::Pause() {
+    chSemWait(&IBusy);
+    f_close(&IPageFile);
+}
+
+// Card may be changed by USB host: page cache and filter are built again from what is there now
+void IDStore_t::Resume() {
+    IOpenPages();
+    IRebuildBloom();
+    chSemSignal(&IBusy);
+}
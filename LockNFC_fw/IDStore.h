@@ -4,9 +4,30 @@
  *  Created on: 25.11.2011
  *      Author: Kreyl
  *
- *      Beware: number of stored IDs and Save function are made for data to fit
- *      to (2 pages = 2048 bytes), and for page size of 1024 bytes. Change this if needed.
- *      Payload data size is (252 * 8 bytes = 2016 bytes) + (4 bytes of count) + (4 bytes of EraseCounter) = 2024 bytes
+ *      IDs are stored on SD in binary file: header with counts of every group,
+ *      then packed 8-byte IDs of Adder, Remover and Secret groups, then fence
+ *      keys of Access pages. CRC32 in header covers all of it.
+ *      Access group may hold thousands of IDs, so it lives in separate page file:
+ *      sorted IDs, one sector per page. First ID of every page (fence key) is kept
+ *      in RAM, so lookup reads at most one sector; last read page is cached.
+ *      Changes of Access group made after page file was written are kept in RAM
+ *      delta table and merged into new page file on compaction. There are two
+ *      page files used in turn: base file tells which one is current.
+ *      Batch edits of Access group are sorted once and merged into page file
+ *      in single pass, so no page is read per ID; ini import is done this way.
+ *      If ID_Store.ini is found on the card, it is imported and renamed, so
+ *      IDs may still be edited as text when needed.
+ *      Every change is appended to journal file; on boot, journal is replayed
+ *      over the base file. When journal grows too long, it is folded into base.
+ *      SD is written by low-priority IdStore thread only: App thread posts
+ *      journal records and base snapshots to it and never waits for the card.
+ *      New base is written to temporary file and renamed, so old one is intact
+ *      until new one is complete.
+ *      Bloom filter over all the IDs rejects most unknown cards without looking
+ *      into index and pages: false positives are below 1% up to ~1500 IDs,
+ *      ~15% with full Access group, and each one costs a page read.
+ *      Removed IDs stay in filter until it is rebuilt in place by IdStore thread
+ *      along with the base; filter is not used meanwhile.
  */
 
 #ifndef IDSTORE_H_
@@ -16,17 +37,61 @@
 #include "cmd_uart.h"
 #include "ch.h"
 #include "kl_sd.h"
+#include "kl_buf.h"
 
 #define ID_SZ_BYTES         8   // 7 bytes of Mifare Ultralite's ID
 // Group types: Access, MasterAdder, MasterRemover, Secret
+// Access pages
+#define IDPAGE_ID_CNT       63  // 63 IDs + 8-byte header = 512 bytes, one sector
+#define IDPAGE_MAX_CNT      64
+#define IDPAGE_CACHE_CNT    1
+#define IDPAGE_CLMT_SZ      16  // Cluster link map of page file, for seek without reading FAT
 // Group sizes
-#define ID_ACCESS_CNT       99
+#define ID_ACCESS_CNT       (IDPAGE_ID_CNT * IDPAGE_MAX_CNT)
 #define ID_ADDER_CNT        9
 #define ID_REMOVER_CNT      9
 #define ID_SECRET_CNT       9
+#define ID_SMALL_CNT        (ID_ADDER_CNT + ID_REMOVER_CNT + ID_SECRET_CNT)
+
+// Indexes: power of 2 and at least twice the max count to keep probe chains short.
+// Index over Adder, Remover and Secret groups
+#define ID_INDEX_BITS       6
+// Changes of Access group since page file was written
+#define ID_DELTA_BITS       7
+#define ID_DELTA_MAX_CNT    63
+#define ID_DELTA_COMPACT_CNT 32 // Fold delta into page file when exceeded
+// Batch of Access edits: merged into page file at once, bypassing delta
+#define ID_BATCH_MAX_CNT    192
+// Bloom filter
+#define IDBLOOM_SZ_BYTES    2048    // Power of 2. 4 bits per ID at ID_ACCESS_CNT; 1% would take ~5 KB
+#define IDBLOOM_HASH_CNT    4
+#define IDBLOOM_STALE_MAX   64      // Rebuild filter when that many IDs were removed
+#if (1 << ID_INDEX_BITS) < (2 * ID_SMALL_CNT)
+#error "ID index is too small"
+#endif
+#if (1 << ID_DELTA_BITS) < (2 * ID_DELTA_MAX_CNT)
+#error "ID delta is too small"
+#endif
 
 #if 1 // ========== Files ==========
-#define IDSTORE_FILENAME        "ID_Store.ini"
+#define IDSTORE_FILENAME        "ID_Store.bin"
+#define IDSTORE_SIGNATURE       0x4244494C  // "LIDB"
+#define IDSTORE_VERSION         2
+#define IDSTORE_TMP_FILENAME    "ID_Store.tmp"
+#define IDSTORE_PAGES_FILENAME0 "ID_Store.pg0"
+#define IDSTORE_PAGES_FILENAME1 "ID_Store.pg1"
+
+// Journal of changes made after base file was saved
+#define IDSTORE_JOURNAL_FILENAME    "ID_Store.jnl"
+#define IDSTORE_JOURNAL_MAX_CNT     63  // Records; rewrite base file when exceeded
+
+// Writer thread
+#define IDSTORE_QUEUE_SZ        18  // Records waiting to be written
+#define IDSTORE_EVT_NEW         EVENT_MASK(0)
+
+// Legacy text file: imported once, then renamed
+#define IDSTORE_INI_FILENAME    "ID_Store.ini"
+#define IDSTORE_INI_IMPORTED    "ID_Store.ini.imported"
 
 #define ID_GROUP_NAME_ACCESS    "AccessID"
 #define ID_GROUP_NAME_ADDER     "MasterAdderID"
@@ -36,6 +101,18 @@
 #endif
 
 #if 1 // ========================== Auxilary classes ===========================
+// Header of binary file
+struct IdStoreHdr_t {
+    uint32_t Signature;
+    uint16_t Version;
+    uint16_t CntAdder, CntRemover, CntSecret;
+    uint16_t PageCnt;       // Pages in current page file
+    uint8_t PageGen;        // Which of two page files is current
+    uint8_t Reserved;
+    uint32_t Crc;           // Header before Crc + all the IDs + fences
+} __attribute__ ((__packed__));
+#define IDSTORE_HDR_CRC_SZ  (sizeof(IdStoreHdr_t) - sizeof(uint32_t))
+
 // Struct of single ID. ID is 8-byte wide.
 struct ID_t {
     union {
@@ -50,10 +127,21 @@ struct ID_t {
     void Print() { Uart.Printf("\r%04X %04X\r", ID32[0], ID32[1]); }
     bool operator == (const ID_t &AID) { return (ID32[0] == AID.ID32[0]) and (ID32[1] == AID.ID32[1]); }
     bool operator != (const ID_t &AID) { return (ID32[0] != AID.ID32[0]) or  (ID32[1] != AID.ID32[1]); }
+    bool operator <  (const ID_t &AID) { return memcmp(ID8, AID.ID8, ID_SZ_BYTES) < 0; }   // Order of pages
     ID_t& operator = (const ID_t &AID) { ID32[0] = AID.ID32[0]; ID32[1] = AID.ID32[1]; return *this; }
 } __attribute__ ((__packed__));
 
-// Array of IDs. Length is templated.
+// Journal record. Snapshot is never written to file: it is request to writer thread to save base.
+enum IdJournalOp_t {jopAdd=0xA1, jopRemove=0xA2, jopEraseAll=0xA3, jopSnapshot=0xA4};
+struct IdJournalRec_t {
+    uint8_t Op;
+    uint8_t Kind;
+    uint16_t Check;         // Lower half of CRC32 of the rest: torn record is skipped
+    ID_t ID;
+    uint16_t CalcCheck() { return (uint16_t)Crc32(&ID, sizeof(ID_t), Crc32(this, 2)); }
+} __attribute__ ((__packed__));
+
+// Array of IDs. Length is templated. Order of IDs is not kept: removed one is replaced by the last.
 template <int32_t TCnt>
 struct ID_Array_t {
     int32_t Cnt;        // Number of IDs stored
@@ -86,10 +174,8 @@ struct ID_Array_t {
     uint8_t Remove(ID_t &sID) {
         int32_t indx=0;
         if(ContainsID(sID, &indx)) {
-            if(indx != (Cnt-1)) {  // Check if not last
-                for(int32_t i=indx; i<Cnt-1; i++) ID[i] = ID[i+1];
-            }
             Cnt--;
+            ID[indx] = ID[Cnt];     // Last one takes place of removed
             Uart.Printf("\rID removed, count = %u\r", Cnt);
             return OK;
         }
@@ -98,75 +184,383 @@ struct ID_Array_t {
             return FAILURE;
         }
     }
-    // Save/Load to SD card
-    void Save(const char *GroupName) {
-        SD.iniFile.WriteSection(GroupName);
-        char *p, IDKey[11] = "ID";
-        for(int32_t i=0; i<Cnt; i++) {
-            p = Convert::Int32ToStr(i, &IDKey[2]);
-            *p = 0; // End of string
-            SD.iniFile.WriteArray(IDKey, ID[i].ID8, 8);
+    // Batch edits: FAILURE if some IDs did not fit or were absent
+    uint8_t AddMany(ID_t *PID, uint32_t ACnt) {
+        uint8_t Rslt = OK;
+        for(uint32_t n=0; n<ACnt; n++) {
+            if(ContainsID(PID[n])) continue;
+            if(Cnt == TCnt) Rslt = FAILURE;
+            else ID[Cnt++] = PID[n];
         }
-        SD.iniFile.WriteNewline();
+        if(Rslt != OK) Uart.Printf("\rBase overflow");
+        return Rslt;
     }
-    void Load(const char *GroupName) {
-        Cnt = 0;
-        char *p, IDKey[11] = "ID";
-        while(Cnt < TCnt) {
-            p = Convert::Int32ToStr(Cnt, &IDKey[2]);
-            *p = 0; // End of string
-            if(SD.iniFile.ReadArray(GroupName, IDKey, ID[Cnt].ID8, 8) == OK) Cnt++;
-            else break; // Get out if failed to read array
+    // Single pass over the array: every ID is compared with the batch
+    uint8_t RemoveMany(ID_t *PID, uint32_t ACnt) {
+        uint32_t Removed = 0;
+        int32_t i = 0;
+        while(i < Cnt) {
+            uint32_t n = 0;
+            while(n < ACnt and ID[i] != PID[n]) n++;
+            if(n < ACnt) {
+                Cnt--;
+                ID[i] = ID[Cnt];    // Check the moved one at the same place
+                Removed++;
+            }
+            else i++;
+        }
+        return (Removed == ACnt)? OK : FAILURE;
+    }
+    // Binary image: IDs are copied as is, pointer after the copied ones is returned
+    ID_t* CopyFrom(ID_t *p, uint32_t ACnt) {
+        Cnt = ACnt;
+        memcpy(ID, p, ACnt * ID_SZ_BYTES);
+        return p + ACnt;
+    }
+    ID_t* CopyTo(ID_t *p) {
+        memcpy(p, ID, Cnt * ID_SZ_BYTES);
+        return p + Cnt;
+    }
+    // Import from legacy ini file: handler of iniFile_t::Parse, IDs are added in order of appearance
+    static void IniHandler(void *PContext, const char *AKey, char *AValue) {
+        ID_Array_t *PArr = (ID_Array_t*)PContext;
+        if(strncmp(AKey, "ID", 2) != 0) return;
+        if(PArr->Cnt >= TCnt) {
+            Uart.Printf("\rBase overflow");
+            return;
         }
-//        Uart.Printf("\rCnt=%u; %04X %04X; Id0=%A", Cnt, ID[0].ID32[0], ID[0].ID32[1], ID[0].ID8, 8, ' ');
+        if(iniFile_t::StrToArray(AValue, PArr->ID[PArr->Cnt].ID8, ID_SZ_BYTES) == OK) PArr->Cnt++;
     }
 } __attribute__ ((__packed__));
 
-#endif
+// Page of Access IDs, sorted. Exactly one sector.
+struct IdPage_t {
+    uint16_t Cnt;
+    uint16_t Reserved;
+    uint32_t Crc;           // Cnt, Reserved and IDs
+    ID_t ID[IDPAGE_ID_CNT];
+    uint32_t CalcCrc() { return Crc32(ID, Cnt * ID_SZ_BYTES, Crc32(this, 4)); }
+    // Binary search; returns index of ID or -1
+    int32_t Find(ID_t &sID) {
+        int32_t Lo = 0, Hi = Cnt - 1;
+        while(Lo <= Hi) {
+            int32_t Mid = (Lo + Hi) / 2;
+            if(ID[Mid] == sID) return Mid;
+            if(ID[Mid] < sID) Lo = Mid + 1;
+            else Hi = Mid - 1;
+        }
+        return -1;
+    }
+} __attribute__ ((__packed__));
+
+// Fence key: first ID of the page
+struct IdFence_t {
+    ID_t MinID;
+    uint16_t Cnt;
+} __attribute__ ((__packed__));
 
+// Open-addressed hash index: gives the kind of ID in one probe.
+// Linear probing with backward-shift deletion, so no tombstones are needed.
 enum IdKind_t {ikNone, ikAccess, ikAdder, ikRemover, ikSecret};
+// Used by delta only: Access ID removed after page file was written.
+// Not in IdKind_t, so switches over kind of checked ID need no arm for it.
+static const IdKind_t ikDeleted = (IdKind_t)(ikSecret + 1);
+
+// When the same ID is in several groups, the one checked first wins: Secret, Access, Adder, Remover
+static inline bool KindPrecedes(IdKind_t A, IdKind_t B) {
+    return (A == ikSecret) or (B != ikSecret and A < B);
+}
+
+struct IdIndexSlot_t {
+    ID_t ID;
+    uint8_t Kind;       // ikNone means empty slot
+} __attribute__ ((__packed__));
+
+template <uint32_t TBits>
+class IdIndex_t {
+private:
+    static const uint32_t ISz = (1 << TBits), IMask = ISz - 1;
+    IdIndexSlot_t ISlot[ISz];
+    static uint32_t IHome(ID_t &sID) {
+        uint32_t h = (sID.ID32[0] ^ (sID.ID32[1] * 0x9E3779B1)) * 0x85EBCA6B;
+        return h >> (32 - TBits);
+    }
+    // Returns index of slot containing the ID, or -1 if not found
+    int32_t IFind(ID_t &sID) {
+        uint32_t i = IHome(sID);
+        for(uint32_t n=0; n<ISz; n++) {
+            if(ISlot[i].Kind == ikNone) return -1;  // Empty slot terminates the chain
+            if(ISlot[i].ID == sID) return i;
+            i = (i + 1) & IMask;
+        }
+        return -1;
+    }
+    void IPut(ID_t &sID, IdKind_t Kind, bool Overwrite) {
+        uint32_t i = IHome(sID);
+        for(uint32_t n=0; n<ISz; n++) {
+            if(ISlot[i].Kind == ikNone) {
+                ISlot[i].ID = sID;
+                ISlot[i].Kind = Kind;
+                Cnt++;
+                return;
+            }
+            if(ISlot[i].ID == sID) {
+                if(Overwrite or KindPrecedes(Kind, (IdKind_t)ISlot[i].Kind)) ISlot[i].Kind = Kind;
+                return;
+            }
+            i = (i + 1) & IMask;
+        }
+        Uart.Printf("\rIndex overflow");
+    }
+public:
+    uint32_t Cnt;
+    void Clear() {
+        for(uint32_t i=0; i<ISz; i++) ISlot[i].Kind = ikNone;
+        Cnt = 0;
+    }
+    IdKind_t Get(ID_t &sID) {
+        int32_t i = IFind(sID);
+        return (i < 0)? ikNone : (IdKind_t)ISlot[i].Kind;
+    }
+    void Put(ID_t &sID, IdKind_t Kind) { IPut(sID, Kind, false); }  // Kind of higher precedence is kept
+    void Set(ID_t &sID, IdKind_t Kind) { IPut(sID, Kind, true); }
+    void Delete(ID_t &sID) {
+        int32_t Found = IFind(sID);
+        if(Found < 0) return;
+        uint32_t i = Found, j = Found;
+        // Move back the entries of the chain which would become unreachable
+        while(true) {
+            j = (j + 1) & IMask;
+            if(ISlot[j].Kind == ikNone) break;
+            uint32_t k = IHome(ISlot[j].ID);
+            // Leave entry in place if its home slot is cyclically in (i; j]
+            if((i <= j)? ((i < k) and (k <= j)) : ((i < k) or (k <= j))) continue;
+            ISlot[i] = ISlot[j];
+            i = j;
+        }
+        ISlot[i].Kind = ikNone;
+        Cnt--;
+    }
+    uint32_t Size() { return ISz; }
+    IdIndexSlot_t* GetSlot(uint32_t i) { return &ISlot[i]; }
+    // Copy of occupied slots, for snapshot
+    uint32_t CopyTo(IdIndexSlot_t *p) {
+        uint32_t N = 0;
+        for(uint32_t i=0; i<ISz; i++) if(ISlot[i].Kind != ikNone) p[N++] = ISlot[i];
+        return N;
+    }
+};
+
+// Bloom filter: no false negatives, so ID not found here is surely unknown.
+// Double hashing gives IDBLOOM_HASH_CNT bit positions of two hashes.
+class IdBloom_t {
+private:
+    static const uint32_t IBitCnt = IDBLOOM_SZ_BYTES * 8;
+    uint32_t IBits[IDBLOOM_SZ_BYTES / 4];
+    static void IHash(ID_t &sID, uint32_t *PH1, uint32_t *PH2) {
+        uint32_t h1 = (sID.ID32[0] ^ (sID.ID32[1] * 0x9E3779B1)) * 0x85EBCA6B;
+        uint32_t h2 = (sID.ID32[1] ^ (sID.ID32[0] * 0xC2B2AE35)) * 0x27D4EB2F;
+        *PH1 = h1 ^ (h1 >> 15);
+        *PH2 = (h2 ^ (h2 >> 13)) | 1;
+    }
+public:
+    uint32_t Cnt;       // IDs put since last clear
+    void Clear() {
+        memset(IBits, 0, sizeof(IBits));
+        Cnt = 0;
+    }
+    void Put(ID_t &sID) {
+        uint32_t h1, h2;
+        IHash(sID, &h1, &h2);
+        for(uint32_t i=0; i<IDBLOOM_HASH_CNT; i++, h1 += h2) {
+            uint32_t Bit = h1 & (IBitCnt - 1);
+            IBits[Bit >> 5] |= 1UL << (Bit & 31);
+        }
+        Cnt++;
+    }
+    bool MayContain(ID_t &sID) {
+        uint32_t h1, h2;
+        IHash(sID, &h1, &h2);
+        for(uint32_t i=0; i<IDBLOOM_HASH_CNT; i++, h1 += h2) {
+            uint32_t Bit = h1 & (IBitCnt - 1);
+            if((IBits[Bit >> 5] & (1UL << (Bit & 31))) == 0) return false;
+        }
+        return true;
+    }
+    // False positive rate is about fill ratio to the power of hash count; result is in 0.01%
+    uint32_t EstimateFpr() {
+        uint32_t SetCnt = 0;
+        for(uint32_t i=0; i<countof(IBits); i++) SetCnt += __builtin_popcount(IBits[i]);
+        uint32_t Fill = (SetCnt << 16) / IBitCnt, Fpr = 1UL << 16;    // Q16
+        for(uint32_t i=0; i<IDBLOOM_HASH_CNT; i++) Fpr = (Fpr * Fill) >> 16;
+        return (Fpr * 10000) >> 16;
+    }
+};
+
+// Small groups of binary file: read and written at once
+struct IdStoreImage_t {
+    IdStoreHdr_t Hdr;
+    ID_t ID[ID_SMALL_CNT];
+    uint32_t IDCnt() { return Hdr.CntAdder + Hdr.CntRemover + Hdr.CntSecret; }
+    uint32_t Size() { return sizeof(IdStoreHdr_t) + IDCnt() * ID_SZ_BYTES; }
+    uint32_t CalcCrc(IdFence_t *PFence) {   // Fences follow the IDs in file
+        uint32_t Crc = Crc32(&Hdr, IDSTORE_HDR_CRC_SZ);
+        Crc = Crc32(ID, IDCnt() * ID_SZ_BYTES, Crc);
+        return Crc32(PFence, Hdr.PageCnt * sizeof(IdFence_t), Crc);
+    }
+} __attribute__ ((__packed__));
+
+// State of base saving, shared by App and writer threads
+enum IdSaveState_t {svIdle, svBusy, svDone, svFailed};
+#endif
 
 class IDStore_t {
 private:
-    ID_Array_t<ID_ACCESS_CNT>  IDAccess;
     ID_Array_t<ID_ADDER_CNT>   IDAdder;
     ID_Array_t<ID_REMOVER_CNT> IDRemover;
     ID_Array_t<ID_SECRET_CNT>  IDSecret;
+    IdIndex_t<ID_INDEX_BITS> Index;
+    // Bloom filter. Rebuilt in place by writer thread over new base, Check does not use it then.
+    IdBloom_t Bloom;
+    volatile bool BloomReady;
+    uint32_t BloomStaleCnt, CheckCnt, RejectCnt, FalsePositiveCnt;
+    void IRebuildBloom();
+    void IBuildBloom();
+    void ITakeBloom();
+    void IReindex(ID_t &sID);
+    void IRebuildIndex();
+    uint8_t ILoadBin(const char *AFilename);
+    uint8_t IImportIni();
+    static void IIniAccessHandler(void *PContext, const char *AKey, char *AValue);
+    void Load();
+    // Access pages
+    IdFence_t IFence[2][IDPAGE_MAX_CNT];  // Current and next page files
+    uint32_t IPageCnt[2];
+    uint8_t IGen;                       // Current page file
+    FIL IPageFile;                      // Read by App thread, and by writer thread while merging
+    Semaphore IPageLock;                // Position of IPageFile
+    DWORD IClmt[IDPAGE_CLMT_SZ];
+    IdPage_t ICache[IDPAGE_CACHE_CNT];
+    int32_t ICachedN[IDPAGE_CACHE_CNT];
+    uint32_t ICacheNext;
+    void IOpenPages();
+    static uint8_t IReadPage(FIL *PFile, IdPage_t *PPage);
+    uint8_t IReadPageAt(uint32_t N, IdPage_t *PPage);
+    IdPage_t* IGetPage(uint32_t N);
+    bool IFindInPages(ID_t &sID, int32_t *PIndx);
+    // Access delta
+    IdIndex_t<ID_DELTA_BITS> Delta;
+    bool AccessErased;                  // Current page file is not valid any more
+    uint32_t AccessCnt;
+    bool IHasAccess(ID_t &sID, int32_t *PIndx);
+    uint8_t IAddAccess(ID_t &sID);
+    uint8_t IRemoveAccess(ID_t &sID);
+    uint8_t IDeltaRoom(ID_t &sID);
+    void IDeltaGrown();
+    // Access batch, sorted. Newer than pages, older than delta. Read by writer thread while merged.
+    IdIndexSlot_t IBatch[ID_BATCH_MAX_CNT];
+    uint32_t IBatchCnt;
+    void IBatchPut(ID_t &sID, IdKind_t Kind);
+    void IBatchSeal();
+    int32_t IFindInBatch(ID_t &sID);
+    uint8_t IAccessBatch(ID_t *PID, uint32_t ACnt, IdKind_t Kind);
+    // Merge of pages, batch and delta snapshot into next page file, done by writer thread
+    IdIndexSlot_t ISnapDelta[ID_DELTA_MAX_CNT];
+    uint32_t ISnapDeltaCnt, ISnapBatchCnt, ISnapStaleCnt;
+    bool ISnapErased, IErasedAfterSnap, ISnapBloom;
+    IdPage_t ISrcPage, IDstPage;
+    uint8_t IMergePages();
+    uint8_t IFlushPage(uint32_t *PCnt);
+    void ISwitchPages();
+    void IApplySaved();
+    // Base snapshot; owned by writer thread while SaveState is svBusy
+    IdStoreImage_t Image;
+    volatile IdSaveState_t SaveState;
+    void IBuildImage();
+    uint8_t IWriteBase();
+    uint8_t IWriteImage(uint8_t AGen);
+    uint8_t ICompactNow();
+    // Journal
+    uint32_t JournalCnt;
+    void IJournal(IdJournalOp_t Op, IdKind_t Kind, ID_t *PID);
+    uint8_t IAppendJournal(IdJournalRec_t *PRec);
+    void IReplayJournal();
+    // Writer thread
+    Thread *PThd;
+    FIL IFile;          // Journal, base and pages being written; at boot, base being read
+    Semaphore IBusy;    // Held by writer thread while it is inside FatFs
+    CircBuf_t<IdJournalRec_t, IDSTORE_QUEUE_SZ> Queue;
+    uint8_t IPost(IdJournalRec_t *PRec);
+    // Groups only, index and journal are handled by caller
+    uint8_t IAdd(ID_t &sID, IdKind_t Kind) {
+        switch(Kind) {
+            case ikAccess:  return IAddAccess(sID);
+            case ikAdder:   return IDAdder.Add(sID);
+            case ikRemover: return IDRemover.Add(sID);
+            default: return FAILURE;
+        }
+    }
+    uint8_t IRemove(ID_t &sID, IdKind_t Kind) {
+        switch(Kind) {
+            case ikAccess:  return IRemoveAccess(sID);
+            case ikAdder:   return IDAdder.Remove(sID);
+            case ikRemover: return IDRemover.Remove(sID);
+            default: return FAILURE;
+        }
+    }
+    void IEraseAll() {
+        Delta.Clear();
+        AccessErased = true;
+        IErasedAfterSnap = true;
+        AccessCnt = 0;
+        IBatchCnt = 0;
+        IDAdder.Erase();
+        IDRemover.Erase();
+    }
 public:
-    bool HasChanged;
+    volatile bool HasChanged;   // Change is not in journal, whole base must be saved
     // ID operations
     IdKind_t Check(ID_t &sID, int32_t *PIndx = nullptr);
     uint8_t Add(ID_t &sID, IdKind_t Kind) {
-        uint8_t Rslt = FAILURE;
-        switch(Kind) {
-            case ikAccess:  Rslt = IDAccess.Add(sID);  break;
-            case ikAdder:   Rslt = IDAdder.Add(sID);   break;
-            case ikRemover: Rslt = IDRemover.Add(sID); break;
-            default: break;
+        uint8_t Rslt = IAdd(sID, Kind);
+        if(Rslt == OK) {
+            if(Kind != ikAccess) Index.Put(sID, Kind);
+            Bloom.Put(sID);
+            IJournal(jopAdd, Kind, &sID);
         }
-        if(Rslt == OK) HasChanged = true;   // Failure means absence in base
         return Rslt;
     }
     uint8_t Remove(ID_t &sID, IdKind_t Kind) {
-        uint8_t Rslt = FAILURE;
-        switch(Kind) {
-            case ikAccess:  Rslt = IDAccess.Remove(sID);  break;
-            case ikAdder:   Rslt = IDAdder.Remove(sID);   break;
-            case ikRemover: Rslt = IDRemover.Remove(sID); break;
-            default: break;
+        uint8_t Rslt = IRemove(sID, Kind);
+        if(Rslt == OK) {    // Failure means absence in base
+            if(Kind != ikAccess) IReindex(sID);
+            BloomStaleCnt++;
+            IJournal(jopRemove, Kind, &sID);
         }
-        if(Rslt == OK) HasChanged = true;   // Failure means absence in base
         return Rslt;
     }
-    // Load/save
-    void Load();
-    void Save();
+    // Batch edits: every group is touched once, absent IDs are skipped.
+    // Access batch is merged into pages by writer thread and saved with the base, not journaled;
+    // at most ID_BATCH_MAX_CNT IDs when writer thread runs, any count at boot.
+    // Long batch of other groups is saved as whole base instead of journal records.
+    uint8_t AddMany(ID_t *PID, uint32_t ACnt, IdKind_t Kind);
+    uint8_t RemoveMany(ID_t *PID, uint32_t ACnt, IdKind_t Kind);
     void EraseAll() {
-        IDAccess.Erase();
-        IDAdder.Erase();
-        IDRemover.Erase();
-        HasChanged = true;
+        IEraseAll();
+        IRebuildIndex();
+        IRebuildBloom();
+        IJournal(jopEraseAll, ikNone, nullptr);
     }
+    // Load/save
+    void Init();
+    void Save();
+    void PrintBloomStats();
+    void CompactIfNeeded();
+    // Volume remount: writer thread is held and page file is closed, then reopened
+    void Pause();
+    void Resume();
+    // Inner use
+    void ITask();
 };
 
 #endif /* IDSTORE_H_ */
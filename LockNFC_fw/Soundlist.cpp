@@ -9,82 +9,123 @@
 #include "cmd_uart.h"
 #include "sound.h"
 
-void SndList_t::Init() {
+void SndList_t::Init(const SndDirCfg_t *PDirs, uint32_t ADirCnt) {
+    PDirCfg = PDirs;
+    IDirCnt = MIN(ADirCnt, DIRS_MAX_CNT);
+    Rebuild();
+}
+
+// Call after SD init, and when USB mass storage is off. App thread only: clip of old index may be playing.
+void SndList_t::Rebuild() {
+    Sound.StopAndWait();
+    IFileCnt = 0;
+    IPacked = (IIndexPack() == OK);
+    if(!IPacked) for(uint32_t i=0; i<IDirCnt; i++) IIndexDir(i);
+}
+
+// Current FileInfo is not a dir and is wav or mp3. Short name is used: lfname buffer is not set.
+bool SndList_t::IsPlayable() {
+    if(FileInfo.fattrib & AM_DIR) return false;
+    uint32_t Len = strlen(FileInfo.fname);
+    if(Len <= 4) return false;
+    return (strcasecmp(&FileInfo.fname[Len-3], "mp3") == 0) or (strcasecmp(&FileInfo.fname[Len-3], "wav") == 0);
+}
 
+void SndList_t::BuildFilename(const char* DirName, const char* FName) {
+    // Check if root dir. Empty string allowed, too
+    int Len = strlen(DirName);
+    if((Len > 1) or (Len == 1 and *DirName != '/' and *DirName != '\\')) {
+        strcpy(Filename, DirName);
+        Filename[Len] = '/';
+    }
+    strcpy(&Filename[Len+1], FName);
+}
+
+void SndList_t::IIndexDir(uint32_t DirIndx) {
+    const char* DirName = PDirCfg[DirIndx].Name;
+    SndDir_t *PDir = &IDir[DirIndx];
+    PDir->Start = IFileCnt;
+    PDir->Cnt = 0;
+    if(f_opendir(&Dir, DirName) != FR_OK) return;
+    while(f_readdir(&Dir, &FileInfo) == FR_OK and FileInfo.fname[0] != 0) {
+        if(!IsPlayable()) continue;
+        SndFile_t *PSnd = IAddFile();
+        if(PSnd == nullptr) break;
+        strcpy(PSnd->Name, FileInfo.fname);
+        PSnd->Sz = FileInfo.fsize;
+        PDir->Cnt++;
+    }
+    Uart.Printf("%S: %u files\r", DirName, PDir->Cnt);
 }
 
-FRESULT SndList_t::CountFilesInDir(const char* DirName, uint32_t *PCnt) {
-    FRESULT Rslt = f_opendir(&Dir, DirName);
-    if(Rslt != FR_OK) return Rslt;
-    *PCnt = 0;
-    while(true) {
-        Rslt = f_readdir(&Dir, &FileInfo);
-        if(Rslt != FR_OK) return Rslt;
-        if((FileInfo.fname[0] == 0) and (FileInfo.lfname[0] == 0)) return FR_OK;   // No files left
-        else { // Filename ok, check if not dir
-            if(!(FileInfo.fattrib & AM_DIR)) {
-                // Check if wav or mp3
-                char *FName = (FileInfo.lfname[0] == 0)? FileInfo.fname : FileInfo.lfname;
-//                Uart.Printf("\r%S", FName);
-                uint32_t Len = strlen(FName);
-                if(Len > 4) {
-                    if((strcasecmp(&FName[Len-3], "mp3") == 0) or (strcasecmp(&FName[Len-3], "wav") == 0)) (*PCnt)++;
-                } // if Len>4
-            } // if not dir
-        } // Filename ok
+SndFile_t *SndList_t::IAddFile() {
+    if(IFileCnt >= SND_INDEX_SZ) {
+        Uart.Printf("Snd index full\r");
+        return nullptr;
     }
-    return FR_OK;
+    return &IFiles[IFileCnt++];
+}
+
+// Table is read once per dir: entries of a dir need not be adjacent. Common file of App thread is used.
+uint8_t SndList_t::IIndexPack() {
+    FIL *PFile = &SD.File;
+    if(f_open(PFile, SND_PACK_FILENAME, FA_READ+FA_OPEN_EXISTING) != FR_OK) return FAILURE;
+    SndPackHdr_t Hdr;
+    SndPackEntry_t Entry;
+    UINT Sz;
+    if(f_read(PFile, &Hdr, sizeof(Hdr), &Sz) != FR_OK or Sz != sizeof(Hdr) or
+            Hdr.Magic != SND_PACK_MAGIC or Hdr.Version != SND_PACK_VERSION) {
+        Uart.Printf("%S: bad header\r", SND_PACK_FILENAME);
+        f_close(PFile);
+        return FAILURE;
+    }
+    for(uint32_t DirIndx=0; DirIndx<IDirCnt; DirIndx++) {
+        const char* DirName = PDirCfg[DirIndx].Name;
+        SndDir_t *PDir = &IDir[DirIndx];
+        PDir->Start = IFileCnt;
+        PDir->Cnt = 0;
+        for(uint32_t i=0; i<Hdr.ClipCnt; i++) {
+            if(f_lseek(PFile, sizeof(Hdr) + i * sizeof(Entry)) != FR_OK) break;
+            if(f_read(PFile, &Entry, sizeof(Entry), &Sz) != FR_OK or Sz != sizeof(Entry)) break;
+            if(strncasecmp(Entry.Group, DirName, SND_PACK_GROUP_SZ) != 0) continue;
+            if((Entry.Offset + Entry.Length) > PFile->fsize) continue;
+            SndFile_t *PSnd = IAddFile();
+            if(PSnd == nullptr) break;
+            PSnd->Offset = Entry.Offset;
+            PSnd->Sz = Entry.Length;
+            PDir->Cnt++;
+        }
+        Uart.Printf("%S: %u clips in pack\r", DirName, PDir->Cnt);
+    }
+    f_close(PFile);
+    Sound.OpenPack(SND_PACK_FILENAME);
+    return OK;
 }
 
 void SndList_t::PlayRandomFileFromDir(const char* DirName) {
-    uint32_t Cnt=0;
-    FRESULT Rslt = CountFilesInDir(DirName, &Cnt);
-    if(Rslt != FR_OK or Cnt == 0) return;       // Get out if nothing to play
-//    Uart.Printf("\rR=%u; Cnt=%u", Rslt, Cnt);
+    SndDir_t *PDir = nullptr;
+    uint32_t DirIndx;
+    for(DirIndx=0; DirIndx<IDirCnt; DirIndx++) {
+        if(strcmp(PDirCfg[DirIndx].Name, DirName) == 0) {
+            PDir = &IDir[DirIndx];
+            break;
+        }
+    }
+    if(PDir == nullptr or PDir->Cnt == 0) return;   // Get out if nothing to play
     // Select number of file
     uint32_t N = 0;
-    if(Cnt > 1) {   // Get random number if count > 1
+    if(PDir->Cnt > 1) {   // Get random number if count > 1
         do {
-            N = Random(Cnt-1);      // [0; Cnt-1]
-        } while(N == PreviousN);    // skip same as previous
+            N = Random(PDir->Cnt-1);    // [0; Cnt-1]
+        } while(N == PreviousN);        // skip same as previous
     }
 //    Uart.Printf("; Random=%u", N);
     PreviousN = N;
-    // Iterate files in dir until success
-    uint32_t Counter = 0;
-    Rslt = f_opendir(&Dir, DirName);
-    if(Rslt != FR_OK) return;
-    while(true) {
-        Rslt = f_readdir(&Dir, &FileInfo);
-        if(Rslt != FR_OK) return;
-        if((FileInfo.fname[0] == 0) and (FileInfo.lfname[0] == 0)) return;  // somehow no files left
-        else { // Filename ok, check if not dir
-            if(!(FileInfo.fattrib & AM_DIR)) {
-                // Check if wav or mp3
-                char *FName = (FileInfo.lfname[0] == 0)? FileInfo.fname : FileInfo.lfname;
-//                Uart.Printf("\r%S  Cnt=%u", FName, Counter);
-                uint32_t Len = strlen(FName);
-                if(Len > 4) {
-                    if((strcasecmp(&FName[Len-3], "mp3") == 0) or (strcasecmp(&FName[Len-3], "wav") == 0)) {
-                        if(N == Counter) {
-                            // Build full filename with path
-                            // Check if root dir. Empty string allowed, too
-                            int Len = strlen(DirName);
-                            if((Len > 1) or (Len == 1 and *DirName != '/' and *DirName != '\\')) {
-                                strcpy(Filename, DirName);
-                                Filename[Len] = '/';
-                            }
-                            strcpy(&Filename[Len+1], FName);
-                            Sound.Play(Filename);
-                            return;
-                        }
-                        else Counter++;
-                    }
-                } // if Len>4
-            } // if not dir
-        } // Filename o
-    } // while true
+    SndFile_t *PSnd = &IFiles[PDir->Start + N];
+    if(IPacked) Sound.PlayPack(PSnd->Offset, PSnd->Sz);
+    else {
+        BuildFilename(DirName, PSnd->Name);
+        Sound.Play(Filename);
+    }
 }
 
-
-
@@ -11,20 +11,69 @@
 #include "kl_lib_f2xx.h"
 #include "kl_sd.h"
 
-#define DIRS_MAX_CNT     3  // Max number of dirs used. Here GoodKey, BadKey, Closing
+#define DIRS_MAX_CNT     4  // Max number of dirs used. Here GoodKey, BadKey, Closing, Secret
+#define SND_INDEX_SZ     32 // Max number of files in all dirs
 
+/* Clip pack, built by Tools/sndpack.py. Used instead of dirs if present.
+ * Header, then ClipCnt entries, then clips; all little endian, clips start at 512-byte boundary. */
+#define SND_PACK_FILENAME   "sounds.pak"
+#define SND_PACK_MAGIC      0x4B415053  // "SPAK"
+#define SND_PACK_VERSION    1
+#define SND_PACK_GROUP_SZ   12          // Dir name, zero padded
+
+struct SndPackHdr_t {
+    uint32_t Magic;
+    uint16_t Version;
+    uint16_t ClipCnt;
+    uint32_t Reserved[2];
+} __attribute__ ((__packed__));
+
+struct SndPackEntry_t {
+    char Group[SND_PACK_GROUP_SZ];
+    uint32_t Offset;
+    uint32_t Length;
+} __attribute__ ((__packed__));
+
+struct SndDirCfg_t {
+    const char* Name;
+};
+
+struct SndFile_t {
+    union {
+        char Name[13];      // 8.3 name is enough to open file
+        uint32_t Offset;    // Clip in pack
+    };
+    uint32_t Sz;
+};
+
+struct SndDir_t {
+    uint32_t Start, Cnt;    // Files in index
+};
+
+/* Index of playable files, built once and rebuilt only after card
+ * was written over USB: random pick needs no directory scanning. */
 class SndList_t {
 private:
     char Filename[MAX_NAME_LEN];    // to store name with path
     uint32_t PreviousN;
     DIR Dir;
     FILINFO FileInfo;
-    FRESULT CountFilesInDir(const char* DirName, uint32_t *PCnt);
+    bool IsPlayable();
+    void BuildFilename(const char* DirName, const char* FName);
+    // Index
+    const SndDirCfg_t *PDirCfg;
+    uint32_t IDirCnt;
+    SndDir_t IDir[DIRS_MAX_CNT];
+    SndFile_t IFiles[SND_INDEX_SZ];
+    uint32_t IFileCnt;
+    void IIndexDir(uint32_t DirIndx);
+    bool IPacked;
+    uint8_t IIndexPack();
+    SndFile_t *IAddFile();
 public:
-    void Init();
+    void Init(const SndDirCfg_t *PDirs, uint32_t ADirCnt);
+    void Rebuild();
     void PlayRandomFileFromDir(const char* DirName);
 };
 
-
-
 #endif /* SRC_SOUNDLIST_H_ */
@@ -28,6 +28,7 @@
 #define EVTMSK_USB_DISCONNECTED EVENT_MASK(22)
 
 // Inner use
+#define EVTMSK_PN_RESCHEDULE    EVENT_MASK(26)
 #define EVTMSK_PN_NEW_PKT       EVENT_MASK(27)
 #define EVTMSK_PN_TX_COMPLETED  EVENT_MASK(28)
 #define EVTMSK_PN_RX_COMPLETED  EVENT_MASK(29)
@@ -12,6 +12,24 @@
 Clk_t Clk;
 
 // =================================== Clk =====================================
+uint8_t Clk_t::Subscribe(ftClkChangeI_t Callback, void *PContext) {
+    chSysLock();
+    if(ISubscriberCnt >= CLK_SUBSCRIBERS_MAX) {
+        chSysUnlock();
+        return FAILURE;
+    }
+    ISubscribers[ISubscriberCnt].Callback = Callback;
+    ISubscribers[ISubscriberCnt].PContext = PContext;
+    ISubscriberCnt++;
+    chSysUnlock();
+    return OK;
+}
+
+void Clk_t::INotifyI() {
+    InitSysTick();
+    for(uint32_t i=0; i<ISubscriberCnt; i++) ISubscribers[i].Callback(ISubscribers[i].PContext);
+}
+
 uint8_t Clk_t::HSEEnable() {
     RCC->CR |= RCC_CR_HSEON;    // Enable HSE
     // Wait until ready
@@ -24,6 +24,11 @@
  * Keep in mind that Flash latency need to be increased at higher speeds.
  * Tune it with SetupFlashLatency.
  *
+ * Drivers whose timings depend on bus clocks subscribe with Subscribe(); their
+ * callbacks are called by SetFreqXXX right after switching, in locked context.
+ * Callback must not touch the bus in the middle of transfer: remember new
+ * values and apply them between transactions.
+ *
  * AHB  freq max = 120 MHz;
  * APB1 freq max = 30 MHz;
  * APB2 freq max = 60 MHz.
@@ -50,11 +55,24 @@ enum PllSysDiv_P_t {pllSysDiv2=0b00, pllSysDiv4=0b01, pllSysDiv6=0b10, pllSysDiv
 enum Mco1Src_t {mco1HSI=0x00000000, mco1LSE=0x00200000, mco1HSE=0x00400000, mco1PLL=0x00600000};
 enum McoDiv_t {mcoDiv1=0x00000000, mcoDiv2=0x04000000, mcoDiv3=0x05000000, mcoDiv4=0x06000000, mcoDiv5=0x07000000};
 
+// Clock change subscribers
+typedef void (*ftClkChangeI_t)(void *PContext);
+#define CLK_SUBSCRIBERS_MAX 8
+
+struct ClkSubscriber_t {
+    ftClkChangeI_t Callback;
+    void *PContext;
+};
+
 class Clk_t {
 private:
     uint8_t HSEEnable();
     uint8_t HSIEnable();
     uint8_t PLLEnable();
+    // Zeroed with bss: no constructor, as Clk is used before static init
+    ClkSubscriber_t ISubscribers[CLK_SUBSCRIBERS_MAX];
+    uint32_t ISubscriberCnt;
+    void INotifyI();
 public:
     // Frequency values
     uint32_t AHBFreqHz;     // HCLK: AHB Buses, Core, Memory, DMA; 120 MHz max
@@ -82,12 +100,15 @@ public:
         SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk | SysTick_CTRL_TICKINT_Msk;
         __enable_irq();
     }
-    // Special frequencies
+    // Called with new freqs after every SetFreqXXX; call before switching
+    uint8_t Subscribe(ftClkChangeI_t Callback, void *PContext);
+    // Special frequencies, SysTick is reinitialized
     void SetFreq12Mhz() {
         if(AHBFreqHz < 12000000) SetupFlashLatency(12); // Rise flash latency now if current freq > required
         SetupBusDividers(ahbDiv4, apbDiv1, apbDiv1);
         UpdateFreqValues();
         SetupFlashLatency(AHBFreqHz/1000000);
+        INotifyI();
     }
     void SetFreq48Mhz() {
         if(AHBFreqHz < 48000000) SetupFlashLatency(48);     // Rise flash latency now if current freq > required
@@ -95,6 +116,7 @@ public:
         SetupBusDividers(ahbDiv1, apbDiv4, apbDiv4);    // Peripheral freqs stay the same
         UpdateFreqValues();
         SetupFlashLatency(AHBFreqHz/1000000);
+        INotifyI();
     }
 
     // Clock output
@@ -100,6 +100,7 @@ void CmdUart_t::CompleteCmd() {
 extern "C" {
 void CmdUartTxIrq(void *p, uint32_t flags) { Uart.IRQDmaTxHandler(); }
 }
+static void CmdUartClkChangeI(void *p) { Uart.OnAHBFreqChange(); }
 
 void CmdUart_t::Init(uint32_t ABaudrate) {
     PWrite = TXBuf;
@@ -115,6 +116,7 @@ void CmdUart_t::Init(uint32_t ABaudrate) {
     if(UART == USART1) UART->BRR = Clk.APB2FreqHz / ABaudrate;
     else               UART->BRR = Clk.APB1FreqHz / ABaudrate;
     UART->CR2 = 0;
+    Clk.Subscribe(CmdUartClkChangeI, nullptr);
     // ==== DMA ====
     dmaStreamAllocate     (UART_DMA_TX, IRQ_PRIO_HIGH, CmdUartTxIrq, NULL);
     dmaStreamSetPeripheral(UART_DMA_TX, &UART->DR);
@@ -96,6 +96,36 @@ public:
 };
 */
 
+// ================== Single producer, single consumer buffer ===================
+// No lock: producer moves write index only, consumer moves read index only.
+// Slot is copied before index is published. Sz must be power of 2.
+template <typename T, uint32_t Sz>
+class SpscBuf_t {
+private:
+    T IBuf[Sz];
+    volatile uint32_t IWrIndx=0, IRdIndx=0;     // Free-running
+public:
+    uint8_t Put(T *p) {
+        uint32_t Wr = IWrIndx;
+        if((Wr - IRdIndx) >= Sz) return FAILURE;
+        memcpy(&IBuf[Wr & (Sz-1)], p, sizeof(T));
+        __sync_synchronize();   // Slot is written before index
+        IWrIndx = Wr + 1;
+        return OK;
+    }
+    uint8_t Get(T *p) {
+        uint32_t Rd = IRdIndx;
+        if(Rd == IWrIndx) return FAILURE;
+        __sync_synchronize();   // Index is read before slot
+        memcpy(p, &IBuf[Rd & (Sz-1)], sizeof(T));
+        __sync_synchronize();   // Slot is read before it is freed
+        IRdIndx = Rd + 1;
+        return OK;
+    }
+    inline uint32_t GetFullCount() { return IWrIndx - IRdIndx; }
+    static_assert((Sz & (Sz-1)) == 0, "SpscBuf_t size must be power of 2");
+};
+
 // Buffer for simple types, like uint8_t etc.
 template <typename T, uint32_t Sz>
 class CircBufNumber_t : public CircBuf_t<T, Sz> {
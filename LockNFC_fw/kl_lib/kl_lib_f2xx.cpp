@@ -17,6 +17,7 @@ void Timer_t::InitClock(TIM_TypeDef *Tmr) {
     else if(Tmr == TIM3)  { rccEnableTIM3(FALSE); }
     else if(Tmr == TIM4)  { rccEnableTIM4(FALSE); }
     else if(Tmr == TIM5)  { rccEnableTIM5(FALSE); }
+    else if(Tmr == TIM6)  { rccEnableAPB1(RCC_APB1ENR_TIM6EN, FALSE); }
     else if(Tmr == TIM7)  { rccEnableTIM7(FALSE); }
     else if(Tmr == TIM8)  { rccEnableTIM8(FALSE); }
     else if(Tmr == TIM9)  { rccEnableAPB2(RCC_APB2ENR_TIM9EN, FALSE); }
@@ -27,6 +28,66 @@ void Timer_t::InitClock(TIM_TypeDef *Tmr) {
     else if(Tmr == TIM14) { rccEnableAPB1(RCC_APB1ENR_TIM14EN, FALSE); }
 }
 
+// ============================== UsTimer ======================================
+static UsTimer_t *PUsTmr6 = nullptr, *PUsTmr7 = nullptr;
+
+void UsTimer_t::Init(TIM_TypeDef* Tmr) {
+    ITmr = Tmr;
+    Timer_t::InitClock(Tmr);
+    ITmr->CR1 = TIM_CR1_OPM | TIM_CR1_URS;  // One pulse; UG does not cause IRQ
+    ITmr->DIER = TIM_DIER_UIE;
+    if(Tmr == TIM6) {
+        PUsTmr6 = this;
+        nvicEnableVector(TIM6_DAC_IRQn, CORTEX_PRIORITY_MASK(IRQ_PRIO_MEDIUM));
+    }
+    else if(Tmr == TIM7) {
+        PUsTmr7 = this;
+        nvicEnableVector(TIM7_IRQn, CORTEX_PRIORITY_MASK(IRQ_PRIO_MEDIUM));
+    }
+}
+
+void UsTimer_t::Sleep(uint32_t Us) {
+    if(Us == 0) return;
+    TRIM_VALUE(Us, 0xFFFF);
+    // APB1 timers are clocked twice faster if APB1 prescaler != 1
+    uint32_t TmrClk = (Clk.APB1FreqHz == Clk.AHBFreqHz)? Clk.APB1FreqHz : (2 * Clk.APB1FreqHz);
+    chSysLock();
+    ITmr->PSC = (TmrClk / 1000000) - 1;
+    ITmr->ARR = Us;
+    ITmr->EGR = TIM_EGR_UG;     // Load prescaler and reset counter
+    ITmr->SR = 0;
+    ITmr->CR1 |= TIM_CR1_CEN;
+    PWaitingThd = chThdSelf();
+    chSchGoSleepS(THD_STATE_SUSPENDED);
+    chSysUnlock();
+}
+
+void UsTimer_t::IIrqHandlerI() {
+    ITmr->SR = 0;
+    if(PWaitingThd != nullptr) {
+        PWaitingThd->p_u.rdymsg = RDY_OK;
+        chSchReadyI(PWaitingThd);
+        PWaitingThd = nullptr;
+    }
+}
+
+extern "C" {
+CH_IRQ_HANDLER(TIM6_IRQHandler) {
+    CH_IRQ_PROLOGUE();
+    chSysLockFromIsr();
+    if(PUsTmr6 != nullptr) PUsTmr6->IIrqHandlerI();
+    chSysUnlockFromIsr();
+    CH_IRQ_EPILOGUE();
+}
+CH_IRQ_HANDLER(TIM7_IRQHandler) {
+    CH_IRQ_PROLOGUE();
+    chSysLockFromIsr();
+    if(PUsTmr7 != nullptr) PUsTmr7->IIrqHandlerI();
+    chSysUnlockFromIsr();
+    CH_IRQ_EPILOGUE();
+}
+} // extern C
+
 void Timer_t::InitPwm(TIM_TypeDef* Tmr, GPIO_TypeDef *GPIO, uint16_t N, uint8_t Chnl, uint32_t ATopValue, Inverted_t Inverted) {
     // GPIO
     if     (ANY_OF_2(Tmr, TIM1, TIM2))       PinSetupAlterFunc(GPIO, N, omPushPull, pudNone, AF1);
@@ -184,6 +245,24 @@ uint32_t Random(uint32_t TopValue) {
     return Rnd;
 }
 
+// ================================== CRC ======================================
+// Half-byte table: small enough for flash, fast enough for some kilobytes
+static const uint32_t Crc32Table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+uint32_t Crc32(const void *PData, uint32_t ALength, uint32_t ACrc) {
+    const uint8_t *p = (const uint8_t*)PData;
+    uint32_t Crc = ~ACrc;
+    while(ALength--) {
+        Crc ^= *p++;
+        Crc = (Crc >> 4) ^ Crc32Table[Crc & 0x0F];
+        Crc = (Crc >> 4) ^ Crc32Table[Crc & 0x0F];
+    }
+    return ~Crc;
+}
+
 // =============================== I2C =========================================
 void i2cDmaIrqHandler(void *p, uint32_t flags) {
     chSysLockFromIsr();
@@ -407,6 +407,10 @@ public:
 // Returns [0; TopValue]
 uint32_t Random(uint32_t TopValue);
 
+// ================================== CRC ======================================
+// CRC-32 (IEEE 802.3, same as zip). Pass previous result as ACrc to continue calculation.
+uint32_t Crc32(const void *PData, uint32_t ALength, uint32_t ACrc = 0);
+
 #if 1 // ============================== Timers =================================
 enum TmrTrigInput_t {tiITR0=0x00, tiITR1=0x10, tiITR2=0x20, tiITR3=0x30, tiTIED=0x40, tiTI1FP1=0x50, tiTI2FP2=0x60, tiETRF=0x70};
 enum TmrMasterMode_t {mmReset=0x00, mmEnable=0x10, mmUpdate=0x20, mmComparePulse=0x30, mmCompare1=0x40, mmCompare2=0x50, mmCompare3=0x60, mmCompare4=0x70};
@@ -467,6 +471,21 @@ public:
     // PWM
     static void InitPwm(TIM_TypeDef* Tmr, GPIO_TypeDef *GPIO, uint16_t N, uint8_t Chnl, uint32_t ATopValue, Inverted_t Inverted = invNotInverted);
 };
+
+/*
+ * Microsecond sleep for SPI chip select setup/hold times: basic timer (TIM6 or TIM7)
+ * in one pulse mode wakes the thread by IRQ, so other threads run meanwhile.
+ * One timer per thread: only one waiter at a time.
+ */
+class UsTimer_t {
+private:
+    TIM_TypeDef* ITmr;
+    Thread *PWaitingThd = nullptr;
+public:
+    void Init(TIM_TypeDef* Tmr);
+    void Sleep(uint32_t Us);
+    void IIrqHandlerI();
+};
 #endif
 
 #if 1 // =============================== IWDG ==================================
@@ -523,6 +542,9 @@ enum SpiBaudrate_t {
 class Spi_t {
 private:
     SPI_TypeDef *PSpi;
+    uint32_t IMaxFreqHz;
+    volatile bool IClkChanged;
+    static void IClkChangeI(void *PContext) { ((Spi_t*)PContext)->IClkChanged = true; }
 public:
     void Setup(SPI_TypeDef *Spi, BitOrder_t BitOrder,
             CPOL_t CPOL, CPHA_t CPHA, SpiBaudrate_t Baudrate) {
@@ -542,6 +564,27 @@ public:
     }
     void Enable () { PSpi->CR1 |=  SPI_CR1_SPE; }
     void Disable() { PSpi->CR1 &= ~SPI_CR1_SPE; }
+    // Baudrate
+    uint32_t GetPClkHz() { return (PSpi == SPI1)? Clk.APB2FreqHz : Clk.APB1FreqHz; }
+    static SpiBaudrate_t CalcBaudrate(uint32_t PClkHz, uint32_t MaxFreqHz) {
+        uint32_t Div = sbFdiv2;
+        while((Div < sbFdiv256) and ((PClkHz >> (Div + 1)) > MaxFreqHz)) Div++;
+        return (SpiBaudrate_t)Div;
+    }
+    void SetBaudrate(SpiBaudrate_t Baudrate) { PSpi->CR1 = (PSpi->CR1 & ~SPI_CR1_BR) | (((uint16_t)Baudrate) << 3); }
+    // Keep SCK below MaxFreqHz at any bus clock. New baudrate is applied by
+    // ApplyClkChange, which must be called when bus is idle.
+    uint8_t SetMaxFreq(uint32_t MaxFreqHz) {
+        IMaxFreqHz = MaxFreqHz;
+        IClkChanged = false;
+        SetBaudrate(CalcBaudrate(GetPClkHz(), MaxFreqHz));
+        return Clk.Subscribe(IClkChangeI, this);
+    }
+    void ApplyClkChange() {
+        if(!IClkChanged) return;
+        IClkChanged = false;
+        SetBaudrate(CalcBaudrate(GetPClkHz(), IMaxFreqHz));
+    }
     uint8_t ReadWriteByte(uint8_t AByte) {
         PSpi->DR = AByte;
         while(!(PSpi->SR & SPI_SR_RXNE));  // Wait for SPI transmission to complete
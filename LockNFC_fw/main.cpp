@@ -23,6 +23,12 @@
 
 App_t App;
 SndList_t SndList;
+static const SndDirCfg_t SndDirs[] = {
+        {DIRNAME_GOOD_KEY},
+        {DIRNAME_BAD_KEY},
+        {DIRNAME_SECRET},
+        {DIRNAME_DOOR_CLOSING},
+};
 
 LedRgbBlinker_t LedService({GPIOB, 10}, {GPIOB, 12}, {GPIOB, 11});
 LedRGB_t Led({GPIOB, 0, TIM3, 3}, {GPIOB, 5, TIM3, 2}, {GPIOB, 1, TIM3, 4});
@@ -65,13 +71,13 @@ int main() {
 
     Pn.Init();
     SD.Init();          // SD-card init
-    App.IDStore.Load(); // Init Srorage of IDs
-    SndList.Init();
+    App.IDStore.Init(); // Init Srorage of IDs
 
     App.ReadConfig();   // Read config from SD-card
     Sound.Init();
     Sound.SetVolume(250);
     Sound.RegisterAppThd(chThdSelf());
+    SndList.Init(SndDirs, countof(SndDirs));    // After Sound: pack is opened by its reader
 //    Sound.Play("alive.wav");
 
 #if USB_ENABLED
@@ -87,7 +93,13 @@ void App_t::ITask() {
     while(true) {
         uint32_t EvtMsk = chEvtWaitAny(ALL_EVENTS);
         // ==== Card ====
-        if(EvtMsk & EVTMSK_CARD_APPEARS) ProcessCardAppearance();
+        if(EvtMsk & EVTMSK_CARD_APPEARS) {
+            CardEvt_t CardEvt;
+            while(Pn.CardEvtBuf.Get(&CardEvt) == OK) {   // Every tap in order
+                memcpy(CurrentID.ID8, CardEvt.ID8, ID_SZ_BYTES);
+                ProcessCardAppearance();
+            }
+        }
 
 #if 1 // ==== Door ====
         if(EvtMsk & EVTMSK_DOOR_OPEN) {
@@ -170,7 +182,6 @@ void App_t::ITask() {
         if(EvtMsk & EVTMSK_USB_CONNECTED) {
             chSysLock();
             Clk.SetFreq48Mhz();
-            Clk.InitSysTick();
             chSysUnlock();
             Usb.Init();
             chThdSleepMilliseconds(540);
@@ -180,9 +191,17 @@ void App_t::ITask() {
         if(EvtMsk & EVTMSK_USB_DISCONNECTED) {
             Usb.Shutdown();
             MassStorage.Reset();
+            // Host could change sounds: drop FatFs state and reindex. Nobody may be inside FatFs meanwhile.
+            if(MassStorage.CardWritten) {
+                MassStorage.CardWritten = false;
+                Sound.CloseFiles();
+                IDStore.Pause();
+                SD.Remount();
+                IDStore.Resume();
+                SndList.Rebuild();
+            }
             chSysLock();
             Clk.SetFreq12Mhz();
-            Clk.InitSysTick();
             chSysUnlock();
             Uart.Printf("Usb disconnected, AHB freq=%uMHz\r", Clk.AHBFreqHz/1000000);
         }
@@ -196,9 +215,12 @@ void App_t::ITask() {
 #if 1 // ========================= States ======================================
 void App_t::EnterState(AppState_t NewState) {
     State = NewState;
+    Pn.SetFastPoll(NewState != asIdle);
     switch(NewState) {
         case asIdle:
-            if(IDStore.HasChanged) IDStore.Save();
+            IDStore.CompactIfNeeded();
+            Pn.PrintPollStats();
+            Pn.DumpStats();
             Led.StartSequence(lsqDoorClose);
             LedService.StartSequence(lsqIdle);
             return;
@@ -367,6 +389,16 @@ void App_t::ProcessCardAppearance() {
 }
 
 uint8_t App_t::ReadConfig() {
+    if(SD.OpenRead(SETTINGS_FILENAME) != OK) {  // Defaults will be used
+        Pn.PollCfg.Validate();
+        return FAILURE;
+    }
+    const IniHandler_t Handlers[] = {
+            {PN_POLL_SECTION, PnPollCfg_t::IniHandler, &Pn.PollCfg},
+    };
+    uint8_t Rslt = SD.iniFile.Parse(Handlers, countof(Handlers));
+    SD.Close();
+    Pn.PollCfg.Validate();
 //    int32_t Probability;
 //    if(SD.iniReadInt32("Sound", "Count", "settings.ini", &SndList.Count) != OK) return FAILURE;
 //    Uart.Printf("\rCount: %d", SndList.Count);
@@ -392,5 +424,5 @@ uint8_t App_t::ReadConfig() {
 //        SndList.Phrases[i].ProbTop = SndList.ProbSumm;
 //    }
 //    for(int i=0; i<SndList.Count; i++) Uart.Printf("\r%u %S Bot=%u Top=%u", i, SndList.Phrases[i].Filename, SndList.Phrases[i].ProbBottom, SndList.Phrases[i].ProbTop);
-    return OK;
+    return Rslt;
 }
@@ -26,6 +26,9 @@
 #define LAST_ID_FILENAME        "Last_ID.txt"
 #endif
 
+// Settings
+#define SETTINGS_FILENAME       "settings.ini"
+
 // File folders
 #define DIRNAME_GOOD_KEY        "GoodKey"
 #define DIRNAME_BAD_KEY         "BadKey"
@@ -25,6 +25,7 @@
 //#define PRINT_TAGS
 
 PN532_t Pn;
+PnSpi_t PnSpi;
 
 extern "C" {
     void PnDmaTxCompIrq(void *p, uint32_t flags);
@@ -39,11 +40,20 @@ static void PnThread(void *arg) {
     Pn.ITask();
 }
 
-void PN532_t::Init() {
+void PN532_t::Init(PnTransport_t *ATransport) {
 #ifdef DBG_PINS
     PinSetupOut(DBG_GPIO1, DBG_PIN1, omPushPull);
     DBG1_CLR();
 #endif
+    PTransport = ATransport;
+    PTransport->Init();
+    State = psSetup;
+    PThd = chThdCreateStatic(waPnThread, sizeof(waPnThread), NORMALPRIO, (tfunc_t)PnThread, NULL);
+    PTransport->PThd = PThd;
+}
+
+#if 1 // ========================== SPI transport ==============================
+void PnSpi_t::Init() {
     // ==== GPIO ====
     PinSetupOut(PN_GPIO, PN_RST_PIN, omPushPull, pudNone);
     PinSetupOut(PN_NSS_GPIO, PN_NSS_PIN, omPushPull, pudNone);
@@ -51,10 +61,11 @@ void PN532_t::Init() {
     PinSetupAlterFunc(PN_GPIO, PN_SCK_PIN, omPushPull, pudNone, AF5);
     PinSetupAlterFunc(PN_GPIO, PN_MISO_PIN, omPushPull, pudPullDown, AF5);
     PinSetupAlterFunc(PN_GPIO, PN_MOSI_PIN, omPushPull, pudNone, AF5);
-    IRstLo();
-    INssHi();
+    PinClear(PN_GPIO, PN_RST_PIN);
+    Deselect();
     // ==== SPI ====    LSB first, master, ClkLowIdle, FirstEdge, Baudrate=f/2
     ISpi.Setup(PN_SPI, boLSB, cpolIdleLow, cphaFirstEdge, sbFdiv8);
+    ISpi.SetMaxFreq(PN_SPI_MAX_FREQ_HZ);
     ISpi.Enable();
     // ==== DMA ====
     // Tx
@@ -67,50 +78,93 @@ void PN532_t::Init() {
     dmaStreamSetMode      (PN_RX_DMA, PN_RX_DMA_MODE);
     // ==== IRQ ====
     IIrqPin.Setup(PN_IRQ_GPIO, PN_IRQ_PIN, ttFalling);
-    // ==== Variables ====
-    State = psSetup;
-    PThd = chThdCreateStatic(waPnThread, sizeof(waPnThread), NORMALPRIO, (tfunc_t)PnThread, NULL);
+    IUsTmr.Init(PN_US_TMR);
 }
 
-void PN532_t::IReset() {
-    IRstLo();
+void PnSpi_t::HwReset() {
+    PinClear(PN_GPIO, PN_RST_PIN);
     chThdSleepMilliseconds(9);
-    IRstHi();
+    PinSet(PN_GPIO, PN_RST_PIN);
     chThdSleepMilliseconds(9);
 }
 
+// Rx DMA always runs: its completion means last byte is shifted out, so no BSY spinning
+uint8_t PnSpi_t::TxRx(void *PTx, void *PRx, uint32_t ALength) {
+    ISpi.ClearOVR();
+    chSysLock();
+    // RX
+    if(PRx != nullptr) {
+        dmaStreamSetMemory0(PN_RX_DMA, PRx);
+        dmaStreamSetMode(PN_RX_DMA, PN_RX_DMA_MODE);
+    }
+    else {
+        dmaStreamSetMemory0(PN_RX_DMA, &IDummy);
+        dmaStreamSetMode(PN_RX_DMA, (PN_RX_DMA_MODE) & ~STM32_DMA_CR_MINC);
+    }
+    dmaStreamSetTransactionSize(PN_RX_DMA, ALength);
+    dmaStreamEnable(PN_RX_DMA);
+    ISpi.EnableRxDma();
+    // TX
+    dmaStreamSetMemory0(PN_TX_DMA, PTx);
+    dmaStreamSetTransactionSize(PN_TX_DMA, ALength);
+    dmaStreamSetMode(PN_TX_DMA, PN_TX_DMA_MODE);
+    dmaStreamEnable(PN_TX_DMA);
+    chSysUnlock();
+    chEvtGetAndClearEvents(EVTMSK_PN_RX_COMPLETED | EVTMSK_PN_TX_COMPLETED);
+    ISpi.EnableTxDma();
+    if(chEvtWaitOneTimeout(EVTMSK_PN_RX_COMPLETED, MS2ST(PN_ACK_TIMEOUT)) == 0) return TIMEOUT;
+    ISpi.WaitBsyLo();   // Half of SCK period at most
+    return OK;
+}
+#endif
+
 __attribute__ ((__noreturn__))
 void PN532_t::ITask() {
     while(true) {
         switch (State) {
             case psConfigured:
-                chThdSleepMilliseconds(PN_POLL_INTERVAL);
                 if(!CardOk) {
+#ifdef PN_AUTOPOLL
+                    if(CardAutoPolled()) {
+#else
+                    IPollInterval = IPollPeriod();
+                    IPollWait(IPollInterval);
+                    IPollStart = chTimeNow();
+                    PollCnt++;
                     if(CardAppeared()) {
-                        if(MifareRead(0) == OK) {
+#endif
+                        if(IIdFromUid or MifareRead(0) == OK) {
                             CardOk = true;
+                            ICountHit();
 //                            Uart.Printf("\rCard Appeared");
-                            App.CurrentID.ConstructOfBuf(PReply->Buf);
+                            if(!IIdFromUid) memcpy(ICardEvt.ID8, PReply->Buf, 8);
+#if PN_CARD_DATA_PAGES > 0
+                            ICardEvt.DataOk = (ReadPages(PN_CARD_DATA_START, PN_CARD_DATA_PAGES, ICardEvt.Data) == OK);
+#endif
+                            if(CardEvtBuf.Put(&ICardEvt) != OK) Uart.Printf("\rCardEvt overflow");
                             App.SendEvt(EVTMSK_CARD_APPEARS);
                         }
                     } // if appeared
                 }
                 else {
+                    IPollWait(IPollPeriod());
                     if(!CardIsStillNear()) {
 //                        Uart.Printf("\rCard Lost");
                         CardOk = false;
+                        Stats.Losses++;
+                        ILastActivity = chTimeNow();
                         App.SendEvt(EVTMSK_CARD_DISAPPEARS);
                     }
                 } // if Card is ok
                 break;
 
             case psSetup:
-                IReset();
-                Cmd(PN_CMD_GET_FIRMWARE_VERSION, WITHOUT_DATA);  // First Cmd will be discarded
-                Cmd(PN_CMD_GET_FIRMWARE_VERSION, WITHOUT_DATA);
-                Cmd(PN_CMD_SAM_CONFIGURATION, 1, 0x01);          // Disable SAM to calm PN: Normal mode, the SAM is not used
-                Cmd(PN_CMD_RF_CONFIGURATION, 4, 0x05, 0x02, 0x01, 0x05);
-                Cmd(PN_CMD_RF_CONFIGURATION, 4, 0x02, 0x00, 0x0B, 0x10);
+                PTransport->HwReset();
+                CmdFrame<PnFrmGetFwVersion>();  // First Cmd will be discarded
+                CmdFrame<PnFrmGetFwVersion>();
+                CmdFrame<PnFrmSamNormal>();     // Disable SAM to calm PN
+                CmdFrame<PnFrmRfRetries>();
+                CmdFrame<PnFrmRfTimings>();
                 State = psConfigured;
                 break;
 
@@ -125,25 +179,114 @@ void PN532_t::ITask() {
 
 bool PN532_t::CardAppeared() {
     FieldOn();
-    if(Cmd(PN_CMD_IN_LIST_PASSIVE_TARGET, 2, 0x01, 0x00) == OK) {
+    if(CmdFrame<PnFrmListTarget>() == OK) {
         if(PReply->RplCode != PN_RPL_IN_LIST_PASSIVE_TARGET or PReply->NbTg == 0) { // Incorrect reply or Nothing found
             FieldOff();
             return false;
         }
-        // ==== Tag is found ====
-#ifdef PRINT_TAGS
-        Uart.Printf("\rTag1: %A", PReply->Buf, (RxDataSz-3), ' '); // without TFI, Rpl code and NbTg
-#endif
+        IGetTarget(PReply->Buf);   // Tag is found
         return true;
     }
     else return false;
 }
 
+// PTgData: Tg, SENS_RES (2 bytes), SEL_RES, NFCID length, NFCID
+void PN532_t::IGetTarget(uint8_t *PTgData) {
+    ICardEvt.Time = chTimeNow();
+    ICardEvt.SensRes = BuildUint16(PTgData[2], PTgData[1]);
+    ICardEvt.SelRes = PTgData[3];
+    /* Ultralight/NTAG (SAK 0, double size UID): page 0 is UID0..2, BCC0; page 1 is UID3..6.
+     * Build ID8 from UID then and skip MifareRead. Classic block 0 holds manufacturer data after UID, so read it. */
+    uint8_t *PUid = &PTgData[5];
+    IIdFromUid = (ICardEvt.SelRes == 0x00 and (ICardEvt.SensRes & 0x00C0) == 0x0040 and PTgData[4] == 7);
+    if(IIdFromUid) {
+        memcpy(&ICardEvt.ID8[0], &PUid[0], 3);
+        ICardEvt.ID8[3] = 0x88 ^ PUid[0] ^ PUid[1] ^ PUid[2];  // BCC0 includes Cascade Tag
+        memcpy(&ICardEvt.ID8[4], &PUid[3], 4);
+    }
+#ifdef PRINT_TAGS
+    Uart.Printf("\rTag1: %A", PTgData, (PTgData[4] + 5), ' ');
+#endif
+}
+
+/* FAST_READ (NTAG, Ultralight EV1) of up to PN_FAST_READ_MAX_PAGES per InCommunicateThru,
+ * extended frame if needed. Pages go to PDst with no intermediate copy.
+ * Like every command, it is sent from poll loop of PN thread: nothing else talks to PN,
+ * so there is no request queue. */
+uint8_t PN532_t::ReadPages(uint32_t AStartPage, uint32_t APageCnt, uint8_t *PDst) {
+    while(APageCnt != 0) {
+        uint32_t N = MIN(APageCnt, PN_FAST_READ_MAX_PAGES), Sz;
+        if(CmdAck(PN_CMD_IN_COMMUNICATE_THRU, 3, MIFARE_CMD_FAST_READ, AStartPage, AStartPage + N - 1) != OK) return FAILURE;
+        if(ReceiveDataTo(PDst, N * 4, &Sz) != OK) return FAILURE;
+        if(PReply->RplCode != PN_CMD_IN_COMMUNICATE_THRU+1 or PReply->Err != 0 or Sz != N * 4) return FAILURE;
+        AStartPage += N;
+        APageCnt -= N;
+        PDst += N * 4;
+    }
+    return OK;
+}
+
+#ifdef PN_AUTOPOLL
+/* PN polls endlessly by itself; thread sleeps in WaitReplyReady until IRQ.
+ * Found target stays activated as Tg 1, so MifareRead works as after InListPassiveTarget. */
+bool PN532_t::CardAutoPolled() {
+    uint32_t Period = IPollPeriod();
+    uint32_t N = (Period + PN_AUTOPOLL_UNIT/2) / PN_AUTOPOLL_UNIT;
+    if(N < 1) N = 1;
+    else if(N > 15) N = 15;
+    if(CmdAck(PN_CMD_IN_AUTO_POLL, 3, 0xFF, N, PN_AUTOPOLL_TYPE) != OK) {
+        Stats.Retries++;
+        IPollWait(PN_POLL_INTERVAL);   // Do not hammer PN if it does not respond
+        return false;
+    }
+    IPCmdStat = nullptr;    // Reply comes when card is found, it is not latency
+    systime_t ArmTime = chTimeNow();
+    uint32_t ArmPeriod = N * PN_AUTOPOLL_UNIT;
+    // Period may back off while waiting: restart autopoll then. Restart it from time to time anyway, in case PN was lost.
+    uint32_t Timeout = (Period < PollCfg.SlowPeriod)? PollCfg.Backoff : PN_AUTOPOLL_REARM;
+    PTransport->EnableReadyIrq();
+    eventmask_t EvtMsk = chEvtWaitAnyTimeout(EVTMSK_PN_NEW_PKT | EVTMSK_PN_RESCHEDULE, MS2ST(Timeout));
+    IPollStart = chTimeNow();
+    IPollInterval = IPollStart - ArmTime;
+    PollCnt += IPollInterval / ArmPeriod + 1;
+    if(IPollInterval > ArmPeriod) IPollInterval = ArmPeriod;
+    if(!(EvtMsk & EVTMSK_PN_NEW_PKT)) {
+        chSysLock();
+        PTransport->DisableReadyIrqI();
+        chSysUnlock();
+        chEvtGetAndClearEvents(EVTMSK_PN_NEW_PKT);  // IRQ may fire before it was disabled
+        IAbort();
+        Stats.Rearms++;
+        return false;
+    }
+    if(ReceiveData() != OK) return false;
+    // Reply: NbTg, Type1, Length1, TargetData1
+    if(PReply->RplCode != PN_CMD_IN_AUTO_POLL+1 or PReply->NbTg == 0) {
+        FieldOff();
+        return false;
+    }
+    IGetTarget(&PReply->Buf[2]);
+    return true;
+}
+#endif
+
+/* Single command per check when tag type allows:
+ * ISO14443-4 card: Diagnose with Attention Request test;
+ * Type 2 tag: READ of page 0 sent directly by InCommunicateThru, no InDataExchange chaining;
+ * others: reselect. */
 bool PN532_t::CardIsStillNear() {
-    // Try to read data from Mifare to determine if it still near
-    //if(MifareRead(nullptr, 0) == OK) return true;
-    if(Cmd(PN_CMD_IN_DESELECT, 1, 0x01) == OK) {
-        if(Cmd(PN_CMD_IN_SELECT, 1, 0x01) == OK) {
+    if(ICardEvt.SelRes & 0x20) {
+        if(CmdFrame<PnFrmAttention>() == OK) {
+            if(PReply->RplCode == PN_RPL_DIAGNOSE and PReply->Err == 0) return true;
+        }
+    }
+    else if(ICardEvt.SelRes == 0x00) {
+        if(CmdFrame<PnFrmReadPage0>() == OK) {
+            if(PReply->RplCode == PN_CMD_IN_COMMUNICATE_THRU+1 and PReply->Err == 0) return true;
+        }
+    }
+    else if(CmdFrame<PnFrmDeselect>() == OK) {
+        if(CmdFrame<PnFrmSelect>() == OK) {
             if(PReply->Err == 0) return true;
         }
     }
@@ -162,76 +305,208 @@ uint8_t PN532_t::MifareRead(uint32_t AAddr) {
     return FAILURE;
 }
 
+#if 1 // ========================= Statistics ====================================
+void PN532_t::IStatBegin(uint8_t CmdID) {
+    ICmdStart = chTimeNow();
+    for(uint32_t i=0; i<PN_STAT_CMD_CNT; i++) {
+        PnCmdStat_t *PStat = &Stats.Cmd[i];
+        if(!PStat->Used) {
+            PStat->Used = 1;
+            PStat->CmdID = CmdID;
+            PStat->MinMs = 0xFFFF;
+        }
+        else if(PStat->CmdID != CmdID) continue;
+        IPCmdStat = PStat;
+        return;
+    }
+    IPCmdStat = nullptr;
+    Stats.CmdOverflow++;
+}
+
+// Called once per command, with result of ACK or reply reception
+void PN532_t::IStatEnd(uint8_t Rslt) {
+    if(IPCmdStat == nullptr) return;
+    if(Rslt == OK) {
+        uint32_t t = chTimeNow() - ICmdStart;
+        if(t > 0xFFFF) t = 0xFFFF;
+        IPCmdStat->Cnt++;
+        IPCmdStat->SumMs += t;
+        if(t < IPCmdStat->MinMs) IPCmdStat->MinMs = t;
+        if(t > IPCmdStat->MaxMs) IPCmdStat->MaxMs = t;
+    }
+    else IPCmdStat->Fails++;
+    IPCmdStat = nullptr;
+}
+
+// "#50,<PnStats_t bytes>"
+void PN532_t::DumpStats() {
+    PnStats_t Copy;
+    chSysLock();
+    memcpy(&Copy, &Stats, sizeof(PnStats_t));
+    chSysUnlock();
+    Uart.Cmd(PN_STAT_DUMP_CODE, (uint8_t*)&Copy, sizeof(PnStats_t));
+}
+#endif
+
+#if 1 // ========================= Poll scheduler ================================
+// Fast in admin states and after activity, then period doubles every Backoff ms of idle
+uint32_t PN532_t::IPollPeriod() {
+    if(IFastPoll) return PollCfg.FastPeriod;
+    uint32_t Idle = chTimeNow() - ILastActivity;
+    if(Idle < PollCfg.FastHold) return PollCfg.FastPeriod;
+    uint32_t Period = PollCfg.IdlePeriod;
+    for(Idle -= PollCfg.FastHold; Idle >= PollCfg.Backoff and Period < PollCfg.SlowPeriod; Idle -= PollCfg.Backoff) Period *= 2;
+    return (Period < PollCfg.SlowPeriod)? Period : PollCfg.SlowPeriod;
+}
+
+// Called by App
+void PN532_t::SetFastPoll(bool AFast) {
+    if(AFast == IFastPoll) return;
+    IFastPoll = AFast;
+    if(!AFast) ILastActivity = chTimeNow();    // Stay fast for a while after admin state
+    chSysLock();
+    chEvtSignalI(PThd, EVTMSK_PN_RESCHEDULE);
+    chSysUnlock();
+}
+
+void PN532_t::PrintPollStats() {
+    Uart.Printf("Poll: %u polls, %u hits, latency %u ms avg, period %u ms\r",
+            PollCnt, HitCnt, (HitCnt == 0)? 0 : (LatencySum / HitCnt), IPollPeriod());
+}
+
+void PnPollCfg_t::IniHandler(void *PContext, const char *AKey, char *AValue) {
+    PnPollCfg_t *PCfg = (PnPollCfg_t*)PContext;
+    uint32_t Value = strtoul(AValue, NULL, 10);
+    if     (strcmp(AKey, "FastPeriod") == 0) PCfg->FastPeriod = Value;
+    else if(strcmp(AKey, "IdlePeriod") == 0) PCfg->IdlePeriod = Value;
+    else if(strcmp(AKey, "SlowPeriod") == 0) PCfg->SlowPeriod = Value;
+    else if(strcmp(AKey, "FastHold")   == 0) PCfg->FastHold   = Value;
+    else if(strcmp(AKey, "Backoff")    == 0) PCfg->Backoff    = Value;
+}
+
+void PnPollCfg_t::Validate() {
+    if(FastPeriod < PN_POLL_MIN) FastPeriod = PN_POLL_MIN;
+    if(IdlePeriod < FastPeriod) IdlePeriod = FastPeriod;
+    if(SlowPeriod < IdlePeriod) SlowPeriod = IdlePeriod;
+    if(Backoff < PN_POLL_MIN) Backoff = PN_POLL_MIN;
+    Uart.Printf("Poll: fast %u, idle %u, slow %u ms; hold %u, backoff %u ms\r", FastPeriod, IdlePeriod, SlowPeriod, FastHold, Backoff);
+}
+#endif
+
 #if 1 // ========================== Data exchange ==============================
 uint8_t PN532_t::Cmd(uint8_t CmdID, uint32_t ADataLength, ...) {
-    uint8_t Rslt = OK;
-    uint32_t FLength;
+    va_list Arg;
+    va_start(Arg, ADataLength);
+    uint8_t Rslt = ICmdSend(CmdID, ADataLength, Arg);
+    va_end(Arg);
+    if(Rslt != OK) return Rslt;
+    return ReceiveData();
+}
+
+// Send command and wait ACK only; reply is to be received later
+uint8_t PN532_t::CmdAck(uint8_t CmdID, uint32_t ADataLength, ...) {
+    va_list Arg;
+    va_start(Arg, ADataLength);
+    uint8_t Rslt = ICmdSend(CmdID, ADataLength, Arg);
+    va_end(Arg);
+    return Rslt;
+}
+
+// Fixed frame from flash: no copying to IBuf, no checksum calculation
+uint8_t PN532_t::ICmdFrame(const uint8_t *PFrame, uint32_t ASz) {
+#ifdef PRINT_IO
+    Uart.Printf("\r>> %A   ", PFrame, ASz, ' ');
+#endif
+    IStatBegin(PFrame[PN_DATA_NORMAL_INDX + 1]);    // After TFI
+    ISendFrame(PFrame, ASz);
+    uint8_t Rslt = ReceiveAck();
+    if(Rslt != OK) return Rslt;
+    return ReceiveData();
+}
+
+// ACK frame from host aborts current PN command (um p.30)
+void PN532_t::IAbort() {
     IBuf[0] = PN_PRE_DATA_WRITE;
+    memcpy(&IBuf[1], &PnPktAck, PN_ACK_NACK_SZ);
+    ISendFrame(IBuf, PN_ACK_NACK_SZ+1);
+}
+
+// Data must be already in place, after TFI and Cmd. Returns frame size.
+uint32_t PN532_t::IBuildFrame(uint8_t *PBuf, uint8_t CmdID, uint32_t ADataLength) {
+    PBuf[0] = PN_PRE_DATA_WRITE;
     // Prologue
-    PrologueExt->Preamble = 0x00;     // Always
-    PrologueExt->SoP0     = 0x00;     // Always
-    PrologueExt->SoP1     = 0xFF;     // Always
-    PrologueExt->NPLC     = 0xFF;     // Always
-    PrologueExt->NPL      = 0xFF;     // Always
+    PnPrologueExt_t *PPrologue = (PnPrologueExt_t*)&PBuf[PN_PROLOGUE_INDX];
+    PPrologue->Preamble = 0x00;     // Always
+    PPrologue->SoP0     = 0x00;     // Always
+    PPrologue->SoP1     = 0xFF;     // Always
+    PPrologue->NPLC     = 0xFF;     // Always
+    PPrologue->NPL      = 0xFF;     // Always
     // Length = 1 (TFI) + 1 (CMD == PD0) + ADataLength
-    FLength = 1 + 1 + ADataLength;
-    PrologueExt->LengthHi = (uint8_t)((FLength >> 8) & 0xFF);
-    PrologueExt->LengthLo = (uint8_t)( FLength       & 0xFF);
-    PrologueExt->CalcLCS();           // LCS + LENGTH == 0
-    // Data
-    uint8_t *pd = &IBuf[PN_DATA_EXT_INDX];  // Beginning of TFI+Data
-    *pd++ = PN_FRAME_TFI_TRANSMIT;
-    *pd++ = CmdID;
-    if(ADataLength != 0) {              // If data present copy it to ComboData Buffer
-        va_list Arg;                    // Init Agr
-        va_start(Arg, ADataLength);     // Set pointer to last argument
-        for(uint32_t i=0; i<ADataLength; i++) *pd++ = (uint8_t)va_arg(Arg, int);
-        va_end(Arg);
-    }
+    uint32_t FLength = 1 + 1 + ADataLength;
+    PPrologue->LengthHi = (uint8_t)((FLength >> 8) & 0xFF);
+    PPrologue->LengthLo = (uint8_t)( FLength       & 0xFF);
+    PPrologue->CalcLCS();           // LCS + LENGTH == 0
+    // TFI and Cmd
+    PBuf[PN_DATA_EXT_INDX]     = PN_FRAME_TFI_TRANSMIT;
+    PBuf[PN_DATA_EXT_INDX + 1] = CmdID;
     // Epilogue
-    WriteEpilogue(FLength);
-    // ==== Transmit frame ====
+    WriteEpilogue(PBuf, FLength);
 #ifdef PRINT_IO
-    Uart.Printf("\r>> %A   ", IBuf, PN_TX_SZ(FLength), ' ');
+    Uart.Printf("\r>> %A   ", PBuf, PN_TX_SZ(FLength), ' ');
 #endif
 #ifdef PRINT_DATA
-    Uart.Printf("\r>> %A   ", &IBuf[PN_DATA_EXT_INDX], 2+ADataLength, ' ');
+    Uart.Printf("\r>> %A   ", &PBuf[PN_DATA_EXT_INDX], FLength, ' ');
 #endif
-    INssLo();
-    ITxRx(IBuf, nullptr, PN_TX_SZ(FLength));
-    INssHi();
-    // ======= Receive =======
-    if((Rslt = ReceiveAck()) != OK) return Rslt;
-    return ReceiveData();
+    return PN_TX_SZ(FLength);
+}
+
+uint8_t PN532_t::ICmdSend(uint8_t CmdID, uint32_t ADataLength, va_list Arg) {
+    uint8_t *pd = &IBuf[PN_DATA_EXT_INDX + 2];  // Data after TFI and Cmd
+    for(uint32_t i=0; i<ADataLength; i++) *pd++ = (uint8_t)va_arg(Arg, int);
+    IStatBegin(CmdID);
+    ISendFrame(IBuf, IBuildFrame(IBuf, CmdID, ADataLength));
+    return ReceiveAck();
 }
 
 uint8_t PN532_t::ReceiveAck() {
     uint8_t Rslt = OK;
-    if((Rslt = WaitReplyReady(PN_ACK_TIMEOUT)) != OK) return Rslt;
+    if((Rslt = WaitReplyReady(PN_ACK_TIMEOUT)) != OK) {
+        Stats.AckTimeouts++;
+        IStatEnd(Rslt);
+        return Rslt;
+    }
     IBuf[0] = PN_PRE_DATA_READ;
     INssLo();
     ITxRx(IBuf, IBuf, PN_ACK_NACK_SZ+1);    // First byte is sequence "read"
     INssHi();
     PnAckNack_t *PAckNack = (PnAckNack_t*)&IBuf[1]; // First byte is reply to sequence "read"
-    Rslt = (*PAckNack == PnPktAck)? OK : FAILURE;
+    if(!(*PAckNack == PnPktAck)) {
+        Stats.Nacks++;
+        IStatEnd(FAILURE);
+        Rslt = FAILURE;
+    }
 #ifdef PRINT_IO
     Uart.Printf("\r<< %A   ", PAckNack, PN_ACK_NACK_SZ, ' ');
 #endif
     return Rslt;
 }
 
-uint8_t PN532_t::ReceiveData() {
+// Leaves NSS low if OK; RxDataSz is TFI + data length
+uint8_t PN532_t::IReceivePrologue(uint8_t **PPRxData) {
     uint8_t Rslt;
     uint8_t* PRxData;
     PReply = nullptr;
-    if((Rslt = WaitReplyReady(PN_DATA_TIMEOUT)) != OK) return Rslt;
+    if((Rslt = WaitReplyReady(PN_DATA_TIMEOUT)) != OK) {
+        Stats.DataTimeouts++;
+        return Rslt;
+    }
     IBuf[0] = PN_PRE_DATA_READ;
     INssLo();
     // Receive reply's prologue
     ITxRx(IBuf, IBuf, PROLOGUE_SZ+1);    // First byte is sequence "read"
     // Check if wrong beginning
     if(!Prologue->IsStartOk()) {
-        Uart.Printf("\rBad start");
+        Stats.BadStart++;
         INssHi();
         return FAILURE;
     }
@@ -240,7 +515,7 @@ uint8_t PN532_t::ReceiveData() {
         ITxRx(IBuf, &PrologueExt->LengthHi, (PROLOGUE_EXT_SZ - PROLOGUE_SZ)); // Receive remainder of prologueExt
         // Check length crc
         if(!PrologueExt->IsLcsOk()) {
-            Uart.Printf("\rBad Ext LCS");
+            Stats.BadLcs++;
             INssHi();
             return FAILURE;
         }
@@ -251,20 +526,28 @@ uint8_t PN532_t::ReceiveData() {
     else {
         // Check length crc
         if(!Prologue->IsLcsOk()) {
-            Uart.Printf("\rBad LCS");
+            Stats.BadLcs++;
             INssHi();
             return FAILURE;
         }
         PRxData = &IBuf[PN_DATA_NORMAL_INDX];
         RxDataSz = Prologue->Len;
     }
+    *PPRxData = PRxData;
+    return OK;
+}
+
+uint8_t PN532_t::IReceiveData() {
+    uint8_t Rslt;
+    uint8_t* PRxData;
+    if((Rslt = IReceivePrologue(&PRxData)) != OK) return Rslt;
     ITxRx(IBuf, PRxData, (RxDataSz + EPILOGUE_SZ));  // Receive data and epilogue
     INssHi();
     // Check DCS
     uint8_t DCS = 0;
     for(uint32_t i=0; i < RxDataSz+1; i++) DCS += PRxData[i]; // TFI + D0 + D1 + ... + DCS
     if(DCS != 0) {
-        Uart.Printf("\rBad DCS");
+        Stats.BadDcs++;
         return FAILURE;
     }
     // All ok
@@ -279,38 +562,39 @@ uint8_t PN532_t::ReceiveData() {
     return OK;
 }
 
-void PN532_t::ITxRx(void *PTx, void *PRx, uint32_t ALength) {
-    ISpi.ClearOVR();
-    chSysLock();
-    uint32_t Msk = EVTMSK_PN_TX_COMPLETED;
-    // RX
-    if(PRx != nullptr) {
-        dmaStreamSetMemory0(PN_RX_DMA, PRx);
-        dmaStreamSetTransactionSize(PN_RX_DMA, ALength);
-        dmaStreamSetMode(PN_RX_DMA, PN_RX_DMA_MODE);
-        dmaStreamEnable(PN_RX_DMA);
-        Msk = EVTMSK_PN_RX_COMPLETED;
-        ISpi.EnableRxDma();
+// TFI, RplCode and Status go to IBuf, rest of data straight to PDst
+uint8_t PN532_t::IReceiveDataTo(uint8_t *PDst, uint32_t AMaxSz, uint32_t *PSz) {
+    uint8_t Rslt;
+    uint8_t* PRxData;
+    if((Rslt = IReceivePrologue(&PRxData)) != OK) return Rslt;
+    if(RxDataSz < 3 or (RxDataSz - 3) > AMaxSz) {
+        Stats.BadLen++;
+        INssHi();
+        return FAILURE;
     }
-    // TX
-    dmaStreamSetMemory0(PN_TX_DMA, PTx);
-    dmaStreamSetTransactionSize(PN_TX_DMA, ALength);
-    dmaStreamSetMode(PN_TX_DMA, PN_TX_DMA_MODE);
-    dmaStreamEnable(PN_TX_DMA);
-    chSysUnlock();
-    chEvtGetAndClearEvents(EVTMSK_PN_RX_COMPLETED | EVTMSK_PN_TX_COMPLETED);
-    ISpi.EnableTxDma();
-    if(chEvtWaitOneTimeout(Msk, MS2ST(PN_ACK_TIMEOUT)) == 0) Uart.Printf("\rTxRxTimeout");
-    ISpi.WaitBsyLo();
+    uint32_t Sz = RxDataSz - 3;
+    ITxRx(IBuf, PRxData, 3);
+    if(Sz != 0) ITxRx(IBuf, PDst, Sz);
+    ITxRx(IBuf, &PRxData[3], EPILOGUE_SZ);
+    INssHi();
+    // Check DCS
+    uint8_t DCS = PRxData[0] + PRxData[1] + PRxData[2] + PRxData[3];
+    for(uint32_t i=0; i < Sz; i++) DCS += PDst[i];
+    if(DCS != 0) {
+        Stats.BadDcs++;
+        return FAILURE;
+    }
+    PReply = (PnReply_t*)PRxData;
+    *PSz = Sz;
+    return OK;
 }
 
 uint8_t PN532_t::WaitReplyReady(uint32_t ATimeout) {
     // Enable IRQ and wait event
-    IIrqPin.CleanIrqFlag();
-    IIrqPin.EnableIrq(IRQ_PRIO_MEDIUM);
+    PTransport->EnableReadyIrq();
     if(chEvtWaitOneTimeout(EVTMSK_PN_NEW_PKT, MS2ST(ATimeout)) == 0) {
         chSysLock();
-        IIrqPin.DisableIrq();
+        PTransport->DisableReadyIrqI();
         chSysUnlock();
 //        Uart.Printf("\rTimeout");
         return TIMEOUT;
@@ -320,7 +604,7 @@ uint8_t PN532_t::WaitReplyReady(uint32_t ATimeout) {
 #endif
 
 #if 1 // ========================= IRQs ========================================
-void PN532_t::IrqPinHandler() { // Interrupt caused by Low level on IRQ_Pin
+void PnSpi_t::IrqPinHandler() { // Interrupt caused by Low level on IRQ_Pin
     IIrqPin.CleanIrqFlag();     // Clear IRQ Pending Bit
     IIrqPin.DisableIrq();       // Disable IRQ
     chEvtSignalI(PThd, EVTMSK_PN_NEW_PKT);
@@ -330,7 +614,7 @@ extern "C" {
 CH_IRQ_HANDLER(PN_IRQ_HANDLER) {
     CH_IRQ_PROLOGUE();
     chSysLockFromIsr();
-    Pn.IrqPinHandler();
+    PnSpi.IrqPinHandler();
     chSysUnlockFromIsr();
     CH_IRQ_EPILOGUE();
 }
@@ -338,17 +622,17 @@ CH_IRQ_HANDLER(PN_IRQ_HANDLER) {
 // DMA transmission complete
 void PnDmaTxCompIrq(void *p, uint32_t flags) {
     dmaStreamDisable(PN_TX_DMA);    // Disable DMA
-    Pn.ISpi.DisableTxDma();         // Disable SPI DMA
+    PnSpi.ISpi.DisableTxDma();      // Disable SPI DMA
     chSysLockFromIsr();
-    chEvtSignalI(Pn.PThd, EVTMSK_PN_TX_COMPLETED);
+    chEvtSignalI(PnSpi.PThd, EVTMSK_PN_TX_COMPLETED);
     chSysUnlockFromIsr();
 }
 // DMA reception complete
 void PnDmaRxCompIrq(void *p, uint32_t flags) {
     dmaStreamDisable(PN_RX_DMA); // Disable DMA
-    Pn.ISpi.DisableRxDma();
+    PnSpi.ISpi.DisableRxDma();
     chSysLockFromIsr();
-    chEvtSignalI(Pn.PThd, EVTMSK_PN_RX_COMPLETED);
+    chEvtSignalI(PnSpi.PThd, EVTMSK_PN_RX_COMPLETED);
     chSysUnlockFromIsr();
 }
 } // extern C
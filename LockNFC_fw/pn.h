@@ -8,13 +8,17 @@
 #ifndef PN_H_
 #define PN_H_
 
+#include <stdarg.h>
 #include "ch.h"
 #include "kl_lib_f2xx.h"
 #include "pn_defins.h"
+#include "kl_buf.h"
+#include "evt_mask.h"
 
 #if 1 // ===================== GPIO, DMA etc. ==================================
 // SPI clock is up to 5MHz (um p.45)
 #define PN_SPI      SPI1
+#define PN_SPI_MAX_FREQ_HZ  5000000 // PN532 datasheet limit
 
 // ==== DMA ====
 #define PN_TX_DMA           STM32_DMA2_STREAM5
@@ -39,6 +43,10 @@
                             STM32_DMA_CR_TCIE      /* Enable Transmission Int C */
 
 
+// ==== Timing ====
+#define PN_US_TMR           TIM6
+#define PN_NSS_SETUP_US     150 // NSS low to first SCK
+
 // ==== PN532 GPIOs PINs ====
 #define PN_GPIO             GPIOA
 #define PN_IRQ_GPIO         GPIOA
@@ -70,7 +78,33 @@
 // Timings
 #define PN_ACK_TIMEOUT      27  // ms
 #define PN_DATA_TIMEOUT     180 // ms
-#define PN_POLL_INTERVAL    504 // ms
+#define PN_POLL_INTERVAL    504 // ms; default idle poll period
+
+// Poll scheduler defaults, overridden by [Poll] section of settings.ini
+#define PN_POLL_SECTION     "Poll"
+#define PN_POLL_FAST        108     // ms; admin states and right after activity
+#define PN_POLL_SLOW        2016    // ms; longest period after back-off
+#define PN_POLL_FAST_HOLD   9000    // ms; stay fast after last activity
+#define PN_POLL_BACKOFF     60000   // ms; period doubles every BACKOFF of idle
+#define PN_POLL_MIN         54      // ms; sanity limit for config values
+
+// Card detection: PN polls by itself and pulls IRQ low when target found. Comment out to poll by software.
+#define PN_AUTOPOLL
+#define PN_AUTOPOLL_UNIT    150     // ms; PN own poll period is N*UNIT, N=1...15
+#define PN_AUTOPOLL_TYPE    0x10    // Mifare card, ISO14443A 106 kbps
+#define PN_AUTOPOLL_REARM   60000   // ms; restart autopoll if nothing found
+
+// Card events to App
+#define PN_CARD_EVT_Q_LEN   4   // Power of 2
+
+// Tag memory: InCommunicateThru reply is TFI, RplCode, Status, Data
+#define PN_FAST_READ_MAX_PAGES  ((PN_MAX_DATA_SZ - 3) / 4)
+#define PN_CARD_DATA_START  4   // First user page of NTAG/Ultralight
+#define PN_CARD_DATA_PAGES  0   // Pages read on every tap and passed to App in CardEvt_t; 0 to disable
+
+// Link health statistics
+#define PN_STAT_CMD_CNT     10      // Commands with latency tracked; first come first served
+#define PN_STAT_DUMP_CODE   0x50    // Uart.Cmd code of binary dump
 
 #if 1 // ======================= Auxilary structures ===========================
 struct PnPrologue_t {
@@ -137,6 +171,130 @@ struct PnReply_t {
     } __attribute__ ((__packed__));
 } __attribute__ ((__packed__));
 
+/* Fixed command frame, built by compiler and placed in flash; DMA sends it as is.
+ * Normal frame: Seq type, 00 00 FF, LEN, LCS, TFI, Cmd, Data, DCS, 00 */
+constexpr uint8_t PnSum() { return 0; }
+template<typename... T>
+constexpr uint8_t PnSum(uint8_t B, T... Rest) { return B + PnSum(Rest...); }
+
+template<uint8_t CmdID, uint8_t... Data>
+struct PnFrame_t {
+    static constexpr uint8_t Len = 2 + sizeof...(Data);    // TFI + Cmd + Data
+    static constexpr uint32_t Sz = 1 + PROLOGUE_SZ + Len + EPILOGUE_SZ;
+    static const uint8_t Buf[Sz];
+};
+template<uint8_t CmdID, uint8_t... Data>
+const uint8_t PnFrame_t<CmdID, Data...>::Buf[Sz] = {
+        PN_PRE_DATA_WRITE, 0x00, 0x00, 0xFF, Len, (uint8_t)(-Len),
+        PN_FRAME_TFI_TRANSMIT, CmdID, Data...,
+        (uint8_t)(-PnSum(PN_FRAME_TFI_TRANSMIT, CmdID, Data...)), 0x00
+};
+
+typedef PnFrame_t<PN_CMD_GET_FIRMWARE_VERSION>                  PnFrmGetFwVersion;
+typedef PnFrame_t<PN_CMD_SAM_CONFIGURATION, 0x01>               PnFrmSamNormal;     // Normal mode, the SAM is not used
+typedef PnFrame_t<PN_CMD_RF_CONFIGURATION, 0x05, 0x02, 0x01, 0x05> PnFrmRfRetries;
+typedef PnFrame_t<PN_CMD_RF_CONFIGURATION, 0x02, 0x00, 0x0B, 0x10> PnFrmRfTimings;
+typedef PnFrame_t<PN_CMD_RF_CONFIGURATION, 0x01, 0x01>          PnFrmFieldOn;
+typedef PnFrame_t<PN_CMD_RF_CONFIGURATION, 0x01, 0x00>          PnFrmFieldOff;
+typedef PnFrame_t<PN_CMD_IN_LIST_PASSIVE_TARGET, 0x01, 0x00>    PnFrmListTarget;    // One target, 106 kbps type A
+typedef PnFrame_t<PN_CMD_DIAGNOSE, 0x06>                        PnFrmAttention;
+typedef PnFrame_t<PN_CMD_IN_COMMUNICATE_THRU, MIFARE_CMD_READ, 0x00> PnFrmReadPage0;
+typedef PnFrame_t<PN_CMD_IN_DESELECT, 0x01>                     PnFrmDeselect;
+typedef PnFrame_t<PN_CMD_IN_SELECT, 0x01>                       PnFrmSelect;
+
+// Card appearance, passed to App thread
+struct CardEvt_t {
+    uint8_t ID8[8];         // First 8 bytes of Mifare page 0: UID
+    systime_t Time;         // When card was found
+    uint16_t SensRes;       // ATQA
+    uint8_t SelRes;         // SAK: tag type
+#if PN_CARD_DATA_PAGES > 0
+    bool DataOk;
+    uint8_t Data[PN_CARD_DATA_PAGES * 4];
+#endif
+};
+
+/* Link health. Only PN thread writes, no locking on update.
+ * Binary dump is this struct as is, little endian; latency is in ms (CH_FREQUENCY is 1000). */
+struct PnCmdStat_t {
+    uint8_t CmdID;
+    uint8_t Used;
+    uint16_t MinMs;
+    uint16_t MaxMs;
+    uint16_t Fails;         // No valid reply: timeout, NACK, bad frame
+    uint32_t Cnt;           // Replies received
+    uint32_t SumMs;         // Avg = SumMs / Cnt
+} __attribute__ ((__packed__));
+
+struct PnStats_t {
+    uint32_t AckTimeouts;
+    uint32_t Nacks;
+    uint32_t DataTimeouts;
+    uint32_t BadStart;
+    uint32_t BadLcs;
+    uint32_t BadDcs;
+    uint32_t BadLen;
+    uint32_t TxRxTimeouts;  // SPI DMA did not complete
+    uint32_t Retries;       // Autopoll not armed and repeated
+    uint32_t Rearms;        // Autopoll restarted with nothing found
+    uint32_t Detections;
+    uint32_t Losses;
+    uint32_t CmdOverflow;   // No free PnCmdStat_t slot
+    PnCmdStat_t Cmd[PN_STAT_CMD_CNT];
+} __attribute__ ((__packed__));
+
+struct PnPollCfg_t {
+    uint32_t FastPeriod  = PN_POLL_FAST;
+    uint32_t IdlePeriod  = PN_POLL_INTERVAL;
+    uint32_t SlowPeriod  = PN_POLL_SLOW;
+    uint32_t FastHold    = PN_POLL_FAST_HOLD;
+    uint32_t Backoff     = PN_POLL_BACKOFF;
+    void Validate();
+    static void IniHandler(void *PContext, const char *AKey, char *AValue);
+};
+#endif
+
+#if 1 // =========================== Transport =================================
+/* Moves bytes between host and PN532 and reports readiness by EVTMSK_PN_NEW_PKT to PThd.
+ * Frame layer (PN532_t) knows nothing else about hardware. */
+class PnTransport_t {
+public:
+    Thread *PThd;
+    virtual void Init() = 0;
+    virtual void HwReset() = 0;
+    virtual void Select() = 0;      // NSS low: frame begins
+    virtual void Deselect() = 0;
+    virtual uint8_t TxRx(void *PTx, void *PRx, uint32_t ALength) = 0;   // PRx may be nullptr
+    virtual void EnableReadyIrq() = 0;
+    virtual void DisableReadyIrqI() = 0;
+};
+
+// SPI1 with DMA2, IRQ line on EXTI
+class PnSpi_t : public PnTransport_t {
+private:
+    IrqPin_t IIrqPin;
+    UsTimer_t IUsTmr;
+    uint8_t IDummy;     // Rx DMA sink for Tx-only transfers
+public:
+    Spi_t ISpi;
+    void Init();
+    void HwReset();
+    void Select() {
+        ISpi.ApplyClkChange();  // Bus is idle here
+        PinClear(PN_NSS_GPIO, PN_NSS_PIN);
+        IUsTmr.Sleep(PN_NSS_SETUP_US);
+    }
+    void Deselect() { PinSet(PN_NSS_GPIO, PN_NSS_PIN); }
+    uint8_t TxRx(void *PTx, void *PRx, uint32_t ALength);
+    void EnableReadyIrq() {
+        IIrqPin.CleanIrqFlag();
+        IIrqPin.EnableIrq(IRQ_PRIO_MEDIUM);
+    }
+    void DisableReadyIrqI() { IIrqPin.DisableIrq(); }
+    inline void IrqPinHandler();    // EXTI P70_IRQ Handler
+};
+
+extern PnSpi_t PnSpi;
 #endif
 
 #if 1 // =========================== PN class ==================================
@@ -145,15 +303,15 @@ enum PnState_t {psOff, psSetup, psConfigured};
 class PN532_t {
 private:
     PnState_t State;
-    IrqPin_t IIrqPin;
+    PnTransport_t *PTransport;
     // Frame
     uint8_t IBuf[1 + PROLOGUE_EXT_SZ + PN_MAX_DATA_SZ + EPILOGUE_SZ]; // Seq type + prologue +...
     PnPrologue_t    *Prologue    = (PnPrologue_t*)   &IBuf[PN_PROLOGUE_INDX];  // Exclude Seq type
     PnPrologueExt_t *PrologueExt = (PnPrologueExt_t*)&IBuf[PN_PROLOGUE_INDX];  // Exclude Seq type
     PnReply_t *PReply;
     uint32_t RxDataSz;
-    void WriteEpilogue(uint16_t ALength) { // [TFI + PD0 + PD1 +  + PDn + DCS] = 0x00
-        uint8_t *p = &IBuf[PN_DATA_EXT_INDX]; // Beginning of TFI+Data
+    void WriteEpilogue(uint8_t *PBuf, uint16_t ALength) { // [TFI + PD0 + PD1 +  + PDn + DCS] = 0x00
+        uint8_t *p = &PBuf[PN_DATA_EXT_INDX]; // Beginning of TFI+Data
         uint8_t Dcs = 0;
         for(uint16_t i=0; i<ALength; i++) Dcs += *p++;
         Dcs = - Dcs;
@@ -161,36 +319,86 @@ private:
         *p = 0x00;  // Postamble
     }
     bool CardOk = false;
-    // Gpio
-    inline void IRstLo()  { PinClear(PN_GPIO, PN_RST_PIN); }
-    inline void IRstHi()  { PinSet  (PN_GPIO, PN_RST_PIN); }
-    inline void INssLo()  {
-        PinClear(PN_NSS_GPIO, PN_NSS_PIN);
-        Loop(200);
-        // chThdSleepMicroseconds(20);
+    CardEvt_t ICardEvt;
+    // Transport
+    inline void INssLo() { PTransport->Select(); }
+    inline void INssHi() { PTransport->Deselect(); }
+    inline void ITxRx(void *PTx, void *PRx, uint32_t ALength) {
+        if(PTransport->TxRx(PTx, PRx, ALength) != OK) Stats.TxRxTimeouts++;
     }
-    inline void INssHi()  { PinSet  (PN_NSS_GPIO, PN_NSS_PIN); }
-    // Inner use
-    void IReset();
     // ==== Data Exchange ====
+    uint32_t IBuildFrame(uint8_t *PBuf, uint8_t CmdID, uint32_t ADataLength);
+    void ISendFrame(const uint8_t *PFrame, uint32_t ASz) {
+        INssLo();
+        ITxRx((void*)PFrame, nullptr, ASz);
+        INssHi();
+    }
+    uint8_t ICmdSend(uint8_t CmdID, uint32_t ADataLength, va_list Arg);
     uint8_t Cmd(uint8_t CmdID, uint32_t ADataLength, ...);
+    uint8_t CmdAck(uint8_t CmdID, uint32_t ADataLength, ...);
+    uint8_t ICmdFrame(const uint8_t *PFrame, uint32_t ASz);
+    template<class TFrame> uint8_t CmdFrame() { return ICmdFrame(TFrame::Buf, TFrame::Sz); }
+    void IAbort();
     uint8_t ReceiveAck();
-    uint8_t ReceiveData();
-    void ITxRx(void *PTx, void *PRx, uint32_t ALength);
+    uint8_t IReceivePrologue(uint8_t **PPRxData);
+    uint8_t IReceiveData();
+    uint8_t IReceiveDataTo(uint8_t *PDst, uint32_t AMaxSz, uint32_t *PSz);
+    uint8_t ReceiveData() {
+        uint8_t Rslt = IReceiveData();
+        IStatEnd(Rslt);
+        return Rslt;
+    }
+    uint8_t ReceiveDataTo(uint8_t *PDst, uint32_t AMaxSz, uint32_t *PSz) {
+        uint8_t Rslt = IReceiveDataTo(PDst, AMaxSz, PSz);
+        IStatEnd(Rslt);
+        return Rslt;
+    }
     uint8_t WaitReplyReady(uint32_t ATimeout);
+    // ==== Statistics ====
+    PnCmdStat_t *IPCmdStat = nullptr;  // Command in progress
+    systime_t ICmdStart;
+    void IStatBegin(uint8_t CmdID);
+    void IStatEnd(uint8_t Rslt);
     // ==== Hi lvl ====
     bool CardAppeared();
+    void IGetTarget(uint8_t *PTgData);
+    bool IIdFromUid;    // ID8 is built from UID, no need to read page 0
+#ifdef PN_AUTOPOLL
+    bool CardAutoPolled();
+#endif
+    // ==== Poll scheduler ====
+    volatile bool IFastPoll = false;
+    systime_t ILastActivity = 0;
+    systime_t IPollStart;       // When current detection began
+    uint32_t IPollInterval;     // Time between polls before it, ms
+    uint32_t IPollPeriod();
+    void IPollWait(uint32_t APeriod) { chEvtWaitAnyTimeout(EVTMSK_PN_RESCHEDULE, MS2ST(APeriod)); }
+    void ICountHit() {
+        HitCnt++;
+        Stats.Detections++;
+        ILastActivity = chTimeNow();
+        LatencySum += IPollInterval / 2 + (ILastActivity - IPollStart);    // Card appears in the middle of interval in average
+    }
     bool CardIsStillNear();
-    void FieldOn()  { Cmd(PN_CMD_RF_CONFIGURATION, 2, 0x01, 0x01); }
-    void FieldOff() { Cmd(PN_CMD_RF_CONFIGURATION, 2, 0x01, 0x00); }
+    void FieldOn()  { CmdFrame<PnFrmFieldOn>(); }
+    void FieldOff() { CmdFrame<PnFrmFieldOff>(); }
     uint8_t MifareRead(uint32_t AAddr);
 public:
-    void Init();
+    uint8_t ReadPages(uint32_t AStartPage, uint32_t APageCnt, uint8_t *PDst);  // PN thread only
+    void Init(PnTransport_t *ATransport = &PnSpi);
     // Inner use
     void ITask();
     Thread *PThd;
-    Spi_t ISpi;
-    inline void IrqPinHandler();    // EXTI P70_IRQ Handler
+    // Events
+    SpscBuf_t<CardEvt_t, PN_CARD_EVT_Q_LEN> CardEvtBuf;
+    // Poll scheduler
+    PnPollCfg_t PollCfg;
+    uint32_t PollCnt = 0, HitCnt = 0, LatencySum = 0;
+    void SetFastPoll(bool AFast);
+    void PrintPollStats();
+    // Link health
+    PnStats_t Stats;
+    void DumpStats();
 };
 #endif
 
@@ -92,6 +92,7 @@
 // Mifare commands
 #define MIFARE_CMD_READ                 0x30
 #define MIFARE_CMD_WRITE                0xA2
+#define MIFARE_CMD_FAST_READ            0x3A    // NTAG, Ultralight EV1: pages Start...End
 
 
 
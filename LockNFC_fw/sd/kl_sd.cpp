@@ -68,6 +68,20 @@ static inline char* striptrailing(char *S) {
     *ptr='\0';
     return S;
 }
+// Terminates value at comment and strips trailing spaces
+static char* ProcessValue(char *StartP) {
+    uint8_t isstring = 0;
+    char *EndP;
+    for(EndP = StartP; (*EndP != '\0') and (((*EndP != ';') and (*EndP != '#')) or isstring) and ((uint32_t)(EndP - StartP) < SD_STRING_SZ); EndP++) {
+        if (*EndP == '"') {
+            if (*(EndP + 1) == '"') EndP++;     // skip "" (both quotes)
+            else isstring = !isstring; // single quote, toggle isstring
+        }
+        else if (*EndP == '\\' and *(EndP + 1) == '"') EndP++; // skip \" (both quotes)
+    } // for
+    *EndP = '\0';   // Terminate at a comment
+    return striptrailing(StartP);
+}
 
 uint8_t iniFile_t::ReadString(const char *ASection, const char *AKey, char **PPOutput) {
 //    Uart.Printf("\rReadString: %S %S", ASection, AKey);
@@ -100,22 +114,42 @@ uint8_t iniFile_t::ReadString(const char *ASection, const char *AKey, char **PPO
     } while(((int32_t)(skiptrailing(EndP, StartP)-StartP) != len or strncmp(StartP, AKey, len) != 0));
 
     // Process Key's value
-    StartP = skipleading(EndP + 1);
-    // Remove a trailing comment
-    uint8_t isstring = 0;
-    for(EndP = StartP; (*EndP != '\0') and (((*EndP != ';') and (*EndP != '#')) or isstring) and ((uint32_t)(EndP - StartP) < SD_STRING_SZ); EndP++) {
-        if (*EndP == '"') {
-            if (*(EndP + 1) == '"') EndP++;     // skip "" (both quotes)
-            else isstring = !isstring; // single quote, toggle isstring
-        }
-        else if (*EndP == '\\' and *(EndP + 1) == '"') EndP++; // skip \" (both quotes)
-    } // for
-    *EndP = '\0';   // Terminate at a comment
-    striptrailing(StartP);
-    *PPOutput = StartP;
+    *PPOutput = ProcessValue(skipleading(EndP + 1));
     return OK;
 }
 
+uint8_t iniFile_t::Parse(const IniHandler_t *PHandlers, uint32_t HandlersCnt) {
+    f_lseek(PFile, 0); // Move to start of file
+    const IniHandler_t *PCurrent = nullptr;    // Handler of current section, if any
+    char *StartP, *EndP;
+    while(f_gets(IStr, SD_STRING_SZ, PFile) != nullptr) {
+        StartP = skipleading(IStr);
+        if((*StartP == ';') or (*StartP == '#') or (*StartP == '\0')) continue;
+        // ==== Section ====
+        if(*StartP == '[') {
+            PCurrent = nullptr;
+            EndP = strchr(StartP, ']');
+            if(EndP == NULL) continue;
+            *EndP = '\0';
+            StartP++;
+            for(uint32_t i=0; i<HandlersCnt; i++) {
+                if(strcmp(StartP, PHandlers[i].Section) == 0) {
+                    PCurrent = &PHandlers[i];
+                    break;
+                }
+            }
+        }
+        // ==== Key ====
+        else if(PCurrent != nullptr) {
+            EndP = strchr(StartP, '=');
+            if(EndP == NULL) continue;
+            *skiptrailing(EndP, StartP) = '\0';    // Terminate key
+            PCurrent->Handler(PCurrent->PContext, StartP, ProcessValue(skipleading(EndP + 1)));
+        }
+    } // while
+    return f_error(PFile)? FAILURE : OK;
+}
+
 uint8_t iniFile_t::ReadInt32(const char *ASection, const char *AKey, int32_t *POutput) {
     char *S = nullptr;
     if(ReadString(ASection, AKey, &S) == OK) {
@@ -133,20 +167,24 @@ static inline uint8_t CharToByte(char c, uint8_t *Rslt) {
     return OK;
 }
 
+// Converts hex string to array of bytes; missing bytes are zeroed
+uint8_t iniFile_t::StrToArray(char *S, uint8_t *p, uint32_t Sz) {
+    if(p == nullptr or Sz == 0) return FAILURE;
+    for(uint32_t i=0; i<Sz; i++) p[i] = 0;
+    for(uint32_t i=0; i<Sz; i++) {
+        if(*S == 0) return OK;
+        uint8_t bHi, bLo;
+        if(CharToByte(*S++, &bHi) != OK) return FAILURE;
+        if(CharToByte(*S++, &bLo) != OK) return FAILURE;
+        p[i] = (bHi << 4) | bLo;
+    } // for i
+    return OK;
+}
+
 uint8_t iniFile_t::ReadArray(const char *ASection, const char *AKey, uint8_t *p, uint32_t Sz) {
     char *S = nullptr;
     if(p == nullptr or Sz == 0) return FAILURE;
-    for(uint32_t i=0; i<Sz; i++) p[i] = 0;
-    if(ReadString(ASection, AKey, &S) == OK) {
-        for(uint32_t i=0; i<Sz; i++) {
-            if(*S == 0) return OK;
-            uint8_t bHi, bLo;
-            if(CharToByte(*S++, &bHi) != OK) return FAILURE;
-            if(CharToByte(*S++, &bLo) != OK) return FAILURE;
-            p[i] = (bHi << 4) | bLo;
-        } // for i
-        return OK;
-    } // if read string
+    if(ReadString(ASection, AKey, &S) == OK) return StrToArray(S, p, Sz);
     else return FAILURE;
 }
 
@@ -40,6 +40,18 @@
 
 #define SD_STRING_SZ    256 // for operations with strings
 
+/*
+ * Single pass parsing: file is read once, every key of section is passed to the
+ * handler registered for that section. Use it when many keys are to be read,
+ * as ReadString rescans the file from the beginning for every key.
+ */
+typedef void (*ftIniHandler_t)(void *PContext, const char *AKey, char *AValue);
+struct IniHandler_t {
+    const char *Section;
+    ftIniHandler_t Handler;
+    void *PContext;
+};
+
 class iniFile_t {
 private:
     char IStr[SD_STRING_SZ];
@@ -48,6 +60,8 @@ public:
     uint8_t ReadString(const char *ASection, const char *AKey, char **PPOutput);
     uint8_t ReadInt32 (const char *ASection, const char *AKey, int32_t *POutput);
     uint8_t ReadArray(const char *ASection, const char *AKey, uint8_t *p, uint32_t Sz);
+    uint8_t Parse(const IniHandler_t *PHandlers, uint32_t HandlersCnt);
+    static uint8_t StrToArray(char *S, uint8_t *p, uint32_t Sz);
 
     void WriteSection(const char *ASection) { f_printf(PFile, "[%S]\r\n", ASection); }
     void WriteInt32(const char *AKey, const int32_t AValue) { f_printf(PFile, "%S=%D\r\n", AKey, AValue); }
@@ -100,6 +114,7 @@ public:
 #endif
     bool IsReady;
     void Init();
+    void Remount() { f_mount(0, &SDC_FS); }    // Volume is mounted again on next access: after writing by USB
 #if INI_FILES_ENABLED
     iniFile_t iniFile;
 #endif
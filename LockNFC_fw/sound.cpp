@@ -42,14 +42,21 @@ static void SoundThread(void *arg) {
     Sound.ITask();
 }
 
+static WORKING_AREA(waSoundRdThread, 512);
+__attribute__((noreturn))
+static void SoundRdThread(void *arg) {
+    chRegSetThreadName("SoundRd");
+    Sound.IRdTask();
+}
+
 __attribute__((noreturn))
 void Sound_t::ITask() {
     while(true) {
         eventmask_t EvtMsk = chEvtWaitAny(ALL_EVENTS);
 #if 1 // ==== DMA done ====
         if(EvtMsk & VS_EVT_DMA_DONE) {
-            ISpi.WaitBsyLo();                   // Wait SPI transaction end
-            if(Clk.AHBFreqHz > 12000000) Loop(450); // Make a solemn pause
+            ISpi.WaitBsyLo();                   // Rx is done, so half of SCK period at most
+            Loop(VS_CS_HOLD_LOOP);              // Make a solemn pause
             XCS_Hi();                           // }
             XDCS_Hi();                          // } Stop SPI
             // Send next data if VS is ready
@@ -67,7 +74,7 @@ void Sound_t::ITask() {
         if(EvtMsk & VS_EVT_COMPLETED) {
 //        	Uart.Printf("\rComp");
             AddCmd(VS_REG_MODE, 0x0004);    // Soft reset
-            if(IFilename != NULL) IPlayNew();
+            if(IFilename != NULL or IPackSz != 0) IPlayNew();
             else {
 //                AmpfOff();    // switch off the amplifier to save energy
                 if(IPAppThd != nullptr) chEvtSignal(IPAppThd, EVTMSK_PLAY_ENDS);  // Raise event if nothing to play
@@ -79,18 +86,11 @@ void Sound_t::ITask() {
             PrepareToStop();
         }
 
-#if 1 // ==== Read next ====
-        else if(EvtMsk & VS_EVT_READ_NEXT) {
-//            Uart.Printf("\rreadNext; L= %u %u", Buf1.DataSz, Buf2.DataSz);
-            FRESULT rslt = FR_OK;
-            bool Eof = f_eof(&IFile);
-            // Read next if not EOF
-            if(!Eof) {
-                if     (Buf1.DataSz == 0) { /*Uart.Printf(" r1");*/ rslt = Buf1.ReadFromFile(&IFile); }
-                else if(Buf2.DataSz == 0) { /*Uart.Printf(" r2");*/ rslt = Buf2.ReadFromFile(&IFile); }
-            }
-            if(rslt != FR_OK) Uart.Printf("sndReadErr=%u\r", rslt);
-            if(rslt == FR_OK and !Eof) StartTransmissionIfNotBusy();
+#if 1 // ==== Data ready ====
+        // Reader filled a slot or reached EOF after ring ran empty
+        else if(EvtMsk & VS_EVT_DATA_READY) {
+            if(State == sndOpening) State = sndPlaying;
+            StartTransmissionIfNotBusy();
         }
 #endif
     } // while true
@@ -112,21 +112,29 @@ void Sound_t::Init() {
 
     // ==== SPI init ====
     ISpi.Setup(VS_SPI, boMSB, cpolIdleLow, cphaFirstEdge, sbFdiv8);
+    ISpi.SetMaxFreq(VS_SPI_MAX_FREQ_HZ);
     ISpi.Enable();
     ISpi.EnableTxDma();
+    ISpi.EnableRxDma();
 
     // ==== DMA ====
     // Here only unchanged parameters of the DMA are configured.
-    dmaStreamAllocate     (VS_DMA, IRQ_PRIO_MEDIUM, SIrqDmaHandler, NULL);
+    dmaStreamAllocate     (VS_DMA, IRQ_PRIO_MEDIUM, NULL, NULL);
     dmaStreamSetPeripheral(VS_DMA, &VS_SPI->DR);
     dmaStreamSetMode      (VS_DMA, VS_DMA_MODE);
+    dmaStreamAllocate     (VS_RX_DMA, IRQ_PRIO_MEDIUM, SIrqDmaHandler, NULL);
+    dmaStreamSetPeripheral(VS_RX_DMA, &VS_SPI->DR);
+    dmaStreamSetMemory0   (VS_RX_DMA, &IDummy);
+    dmaStreamSetMode      (VS_RX_DMA, VS_RX_DMA_MODE);
 
     // ==== Variables ====
     State = sndStopped;
     IDmaIdle = true;
-    PBuf = &Buf1;
     IAttenuation = VS_INITIAL_ATTENUATION;
     chMBInit(&CmdBox, CmdBuf, VS_CMD_BUF_SZ);
+    chMBInit(&IRdCmdBox, IRdCmdBuf, VS_RD_CMD_CNT);
+    chSemInit(&IRdReleased, 0);
+    IOpenReq = false;
 
     // ==== Init VS ====
     Rst_Hi();
@@ -137,6 +145,7 @@ void Sound_t::Init() {
     IDreq.Setup(VS_GPIO, VS_DREQ, ttRising);
     // ==== Thread ====
     PThread = chThdCreateStatic(waSoundThread, sizeof(waSoundThread), NORMALPRIO, (tfunc_t)SoundThread, NULL);
+    PRdThread = chThdCreateStatic(waSoundRdThread, sizeof(waSoundRdThread), NORMALPRIO, (tfunc_t)SoundRdThread, NULL);
 #if VS_AMPF_EXISTS
     PinSetupOut(VS_AMPF_GPIO, VS_AMPF_PIN, omPushPull);
     AmpfOff();
@@ -151,44 +160,182 @@ void Sound_t::Shutdown() {
     Rst_Lo();           // enter shutdown mode
 }
 
+/* Returns when zero sequence is sent and nothing is read from RAM clip or ring anymore.
+ * EVTMSK_PLAY_ENDS is App thread event, so only App thread may wait for it. */
+uint8_t Sound_t::StopAndWait(uint32_t ATimeout) {
+    if(chThdSelf() != IPAppThd) return FAILURE;
+    chEvtGetAndClearEvents(EVTMSK_PLAY_ENDS);
+    Stop();
+    if(chEvtWaitOneTimeout(EVTMSK_PLAY_ENDS, MS2ST(ATimeout)) == 0) {
+        Uart.Printf("Snd stop timeout\r");
+        return TIMEOUT;
+    }
+    return OK;
+}
+
+// Commands are served in order, so reader is out of FatFs when it signals
+void Sound_t::CloseFiles() {
+    StopAndWait();
+    IRdPost(vrcRelease, TIME_INFINITE);
+    chSemWait(&IRdReleased);
+}
+
 void Sound_t::IPlayNew() {
     AmpfOn();
     AddCmd(VS_REG_MODE, VS_MODE_REG_VALUE);
     AddCmd(VS_REG_CLOCKF, (0x8000 + (12000000/2000)));
     AddCmd(VS_REG_VOL, ((IAttenuation * 256) + IAttenuation));
+    IStarted = false;
+    // File is opened by reader; playing starts when first slot is filled
+    if(IPackSz != 0) {
+        Uart.Printf("Play pack clip at %u, %u bytes\r", IPackOffset, IPackSz);
+        IRdFilename = nullptr;
+        IRdStart = IPackOffset;
+        IRdLen = IPackSz;
+        IPackSz = 0;
+        IPosition = 0;
+    }
+    else {
+        Uart.Printf("Play %S at %u\r", IFilename, IStartPosition);
+        IRdFilename = IFilename;
+        IRdStart = IStartPosition;
+        IFilename = NULL;
+        IPosition = IStartPosition;
+    }
+    // Reader of previous clip may still be inside f_read: new generation makes it drop its data
+    chSysLock();
+    IPlayGen++;
+    IRdIndx = 0;
+    IRdOffset = 0;
+    IWrIndx = 0;
+    IFullCnt = 0;
+    IEof = false;
+    IStarving = true;
+    IOpenGen = IPlayGen;
+    IOpenReq = true;
+    chSysUnlock();
+    State = sndOpening;
+    IRdPost(vrcOpen, TIME_IMMEDIATE);   // If box is full, reader is busy and takes request after current command
+}
+
+#if 1 // ================================ Reader ===============================
+__attribute__((noreturn))
+void Sound_t::IRdTask() {
+    msg_t Msg;
+    while(true) {
+        chMBFetch(&IRdCmdBox, &Msg, TIME_INFINITE);
+        switch((VsRdCmd_t)Msg) {
+            case vrcOpen: break;    // Request is taken below
+            case vrcClose: if(IFile.fs != 0) f_close(&IFile); break;
+            case vrcFill:  IRdFill(); break;
+            case vrcOpenPack: IRdOpenPack(); break;
+            case vrcRelease:
+                if(IFile.fs != 0) f_close(&IFile);
+                if(IPackFile.fs != 0) f_close(&IPackFile);
+                chSemSignal(&IRdReleased);
+                break;
+        }
+        // Open request of Sound thread, checked after every command as its vrcOpen may be lost
+        chSysLock();
+        bool DoOpen = IOpenReq;
+        IOpenReq = false;
+        if(DoOpen) IFillGen = IOpenGen;
+        chSysUnlock();
+        if(DoOpen and IFillGen == IPlayGen) IRdOpen();     // Else stopped before opening
+    }
+}
+
+void Sound_t::IRdOpen() {
+    if(IFile.fs != 0) f_close(&IFile);
+    if(IRdFilename == nullptr) IRdOpenClip();
+    else IRdOpenFile();
+}
+
+/* Clip in pack: seek by link map does not read FAT.
+ * Leading read is shortened if needed, so IRdFill stays sector-aligned. */
+void Sound_t::IRdOpenClip() {
+    if(IPackFile.fs == 0) {
+        Uart.Printf("No pack\r");
+        IRdAbort();
+        return;
+    }
+    if(f_lseek(&IPackFile, IRdStart) != FR_OK or IPackFile.fptr != IRdStart) {
+        Uart.Printf("Pack seek error\r");
+        IRdAbort();
+        return;
+    }
+    PRdFile = &IPackFile;
+    IRdLeft = IRdLen;
+    IRdFill();
+}
 
-    FRESULT rslt;
-    // Open new file
-    Uart.Printf("Play %S at %u\r", IFilename, IStartPosition);
-    rslt = f_open(&IFile, IFilename, FA_READ+FA_OPEN_EXISTING);
-    IFilename = NULL;
+void Sound_t::IRdOpenFile() {
+    FRESULT rslt = f_open(&IFile, IRdFilename, FA_READ+FA_OPEN_EXISTING);
     if (rslt != FR_OK) {
-        if (rslt == FR_NO_FILE) Uart.Printf("%S: not found\r", IFilename);
+        if (rslt == FR_NO_FILE) Uart.Printf("%S: not found\r", IRdFilename);
         else Uart.Printf("OpenFile error: %u\r", rslt);
-        Stop();
+        IRdAbort();
         return;
     }
     // Check if zero file
     if (IFile.fsize == 0) {
         f_close(&IFile);
         Uart.Printf("Empty file\r");
-        Stop();
+        IRdAbort();
         return;
     }
     // Fast forward to start position if not zero
-    if(IStartPosition != 0) {
-        if(IStartPosition < IFile.fsize) f_lseek(&IFile, IStartPosition);
+    if(IRdStart != 0) {
+        if(IRdStart < IFile.fsize) f_lseek(&IFile, IRdStart);
     }
+    PRdFile = &IFile;
+    IRdLeft = 0xFFFFFFFF;   // Up to end of file
+    IRdFill();
+}
 
-    // Initially, fill both buffers
-    if(Buf1.ReadFromFile(&IFile) != OK) { Stop(); return; }
-    // Fill second buffer if needed
-    if(Buf1.DataSz == VS_DATA_BUF_SZ) Buf2.ReadFromFile(&IFile);
+// Fill all free slots. Reading stops at once if playing was stopped or restarted meanwhile.
+void Sound_t::IRdFill() {
+    while(IFillGen == IPlayGen and !IEof and IFullCnt < VS_SLOT_CNT) {
+        VsSlot_t *PSlot = &ISlot[IWrIndx];
+        // First read after seek is shortened to make next ones sector-aligned
+        UINT Sz = VS_SLOT_SZ - (PRdFile->fptr % 512), DataSz = 0;
+        if(Sz > IRdLeft) Sz = IRdLeft;
+        FRESULT rslt = f_read(PRdFile, PSlot->Data, Sz, &DataSz);
+        IRdLeft -= DataSz;
+        if(rslt != FR_OK) Uart.Printf("sndReadErr=%u\r", rslt);
+        PSlot->DataSz = DataSz;
+        chSysLock();
+        if(IFillGen == IPlayGen) {  // Not stopped while reading
+            if(DataSz != 0) {
+                IWrIndx = (IWrIndx + 1) % VS_SLOT_CNT;
+                IFullCnt++;
+            }
+            if(rslt != FR_OK or DataSz < Sz or IRdLeft == 0) IEof = true;
+            if(IStarving) {
+                IStarving = false;
+                chEvtSignalI(PThread, VS_EVT_DATA_READY);
+            }
+        }
+        chSysUnlock();
+    }
+}
 
-    PBuf = &Buf1;
-    State = sndPlaying;
-    StartTransmissionIfNotBusy();
+void Sound_t::IRdOpenPack() {
+    if(IPackFile.fs != 0) f_close(&IPackFile);
+    FRESULT rslt = f_open(&IPackFile, IPackFilename, FA_READ+FA_OPEN_EXISTING);
+    if(rslt != FR_OK) {
+        Uart.Printf("%S: open error %u\r", IPackFilename, rslt);
+        return;
+    }
+    // Cluster link map: any clip is reached without following FAT chain
+    IPackClmt[0] = VS_PACK_CLMT_SZ;
+    IPackFile.cltbl = IPackClmt;
+    if(f_lseek(&IPackFile, CREATE_LINKMAP) != FR_OK) {
+        Uart.Printf("%S: too fragmented, %u items needed\r", IPackFilename, IPackClmt[0]);
+        IPackFile.cltbl = 0;    // Normal seek
+    }
 }
+#endif
 
 // ================================ Inner use ==================================
 void Sound_t::AddCmd(uint8_t AAddr, uint16_t AData) {
@@ -201,50 +348,62 @@ void Sound_t::AddCmd(uint8_t AAddr, uint16_t AData) {
     StartTransmissionIfNotBusy();
 }
 
+// Rx DMA reads the same count of bytes into IDummy and reports completion
+void Sound_t::IStartDma(const void *PData, uint32_t ALength, uint32_t AMemInc) {
+    ISpi.ClearOVR();    // Stale byte would be taken by Rx DMA
+    dmaStreamSetTransactionSize(VS_RX_DMA, ALength);
+    dmaStreamSetMode(VS_RX_DMA, VS_RX_DMA_MODE);
+    dmaStreamEnable(VS_RX_DMA);
+    dmaStreamSetMemory0(VS_DMA, PData);
+    dmaStreamSetTransactionSize(VS_DMA, ALength);
+    dmaStreamSetMode(VS_DMA, VS_DMA_MODE | AMemInc);
+    dmaStreamEnable(VS_DMA);
+}
+
 void Sound_t::ISendNextData() {
 //    Uart.Printf("\rSN");
     dmaStreamDisable(VS_DMA);
+    dmaStreamDisable(VS_RX_DMA);
     IDmaIdle = false;
     // ==== If command queue is not empty, send command ====
     msg_t msg = chMBFetch(&CmdBox, &ICmd.Msg, TIME_IMMEDIATE);
     if(msg == RDY_OK) {
 //        Uart.PrintfI("\rvCmd: %A", &ICmd, 4, ' ');
         XCS_Lo();   // Start Cmd transmission
-        dmaStreamSetMemory0(VS_DMA, &ICmd);
-        dmaStreamSetTransactionSize(VS_DMA, sizeof(VsCmd_t));
-        dmaStreamSetMode(VS_DMA, VS_DMA_MODE | STM32_DMA_CR_MINC);  // Memory pointer increase
-        dmaStreamEnable(VS_DMA);
+        IStartDma(&ICmd, sizeof(VsCmd_t), STM32_DMA_CR_MINC);  // Memory pointer increase
     }
     // ==== Send next chunk of data if any ====
     else switch(State) {
         case sndPlaying: {
 //            Uart.PrintfI("\rD");
-            // Switch buffer if required
-            if(PBuf->DataSz == 0) {
-                PBuf = (PBuf == &Buf1)? &Buf2 : &Buf1;      // Switch to next buf
-//                Uart.Printf("\rB=%u; Sz=%u", ((PBuf == &Buf1)? 1 : 2), PBuf->DataSz);
-                if(PBuf->DataSz == 0) { // Previous attempt to read the file failed
-                    IDmaIdle = true;
-                    PrepareToStop();
-                    break;
-                }
-                else {
-                    chSysLock();
-                    chEvtSignalI(PThread, VS_EVT_READ_NEXT);    // Read next chunk of file
-                    chSysUnlock();
-                }
+            chSysLock();
+            bool Eof = IEof, Empty = (IFullCnt == 0);
+            if(Empty) IStarving = true;     // Reader will signal VS_EVT_DATA_READY
+            chSysUnlock();
+            if(Empty) {
+                IDmaIdle = true;
+                if(Eof) PrepareToStop();    // Or read failed
+                else if(IStarted) Underruns++;
+                break;
             }
+            ILogLatency();
             // Send next piece of data
+            VsSlot_t *PSlot = &ISlot[IRdIndx];
             XDCS_Lo();  // Start data transmission
-            uint32_t FLength = (PBuf->DataSz > 32)? 32 : PBuf->DataSz;
-            dmaStreamSetMemory0(VS_DMA, PBuf->PData);
-            dmaStreamSetTransactionSize(VS_DMA, FLength);
-            dmaStreamSetMode(VS_DMA, VS_DMA_MODE | STM32_DMA_CR_MINC);  // Memory pointer increase
-            dmaStreamEnable(VS_DMA);
-//            if(PBuf == &Buf1) Uart.Printf("*"); else Uart.Printf("#");
-            // Process pointers and lengths
-            PBuf->DataSz -= FLength;
-            PBuf->PData += FLength;
+            uint32_t FLength = PSlot->DataSz - IRdOffset;
+            if(FLength > 32) FLength = 32;
+            IStartDma(&PSlot->Data[IRdOffset], FLength, STM32_DMA_CR_MINC);  // Memory pointer increase
+            IRdOffset += FLength;
+            IPosition += FLength;
+            // Release slot if done
+            if(IRdOffset >= PSlot->DataSz) {
+                IRdOffset = 0;
+                IRdIndx = (IRdIndx + 1) % VS_SLOT_CNT;
+                chSysLock();
+                uint32_t FullCnt = --IFullCnt;
+                chSysUnlock();
+                if(FullCnt < VS_PREFETCH_LEVEL) IRdPost(vrcFill, TIME_IMMEDIATE);  // Lost if box is full, reader is busy then anyway
+            }
         } break;
 
         case sndWritingZeroes:
@@ -260,6 +419,7 @@ void Sound_t::ISendNextData() {
             else SendZeroes();
             break;
 
+        case sndOpening:
         case sndStopped:
 //            Uart.PrintfI("\rI");
             if(!IDreq.IsHi()) IDreq.EnableIrq(IRQ_PRIO_MEDIUM);
@@ -271,7 +431,9 @@ void Sound_t::PrepareToStop() {
 //    Uart.Printf("\rPrepare");
     State = sndWritingZeroes;
     ZeroesCount = ZERO_SEQ_LEN;
-    if(IFile.fs != 0) f_close(&IFile);
+    IPlayGen++;     // Reader stops filling the ring
+    IRdPost(vrcClose, TIME_IMMEDIATE);  // If lost, file is closed by next open or release
+    if(Underruns != 0) Uart.Printf("Snd underruns: %u\r", Underruns);
     StartTransmissionIfNotBusy();
 }
 
@@ -279,10 +441,7 @@ void Sound_t::SendZeroes() {
 //    Uart.Printf("sz\r");
     XDCS_Lo();  // Start data transmission
     uint32_t FLength = (ZeroesCount > 32)? 32 : ZeroesCount;
-    dmaStreamSetMemory0(VS_DMA, &SZero);
-    dmaStreamSetTransactionSize(VS_DMA, FLength);
-    dmaStreamSetMode(VS_DMA, VS_DMA_MODE);  // Do not increase memory pointer
-    dmaStreamEnable(VS_DMA);
+    IStartDma(&SZero, FLength, 0);  // Do not increase memory pointer
     ZeroesCount -= FLength;
 }
 
@@ -30,6 +30,7 @@
 
 // SPI
 #define VS_SPI          SPI2
+#define VS_SPI_MAX_FREQ_HZ  (12000000/7)   // SCI reads: CLKI/7, CLKI is XTALI=12MHz
 #define VS_AF           AF5
 #define VS_SPI_RCC_EN() rccEnableSPI2(FALSE)
 // DMA
@@ -39,9 +40,22 @@
                         DMA_PRIORITY_LOW | \
                         STM32_DMA_CR_MSIZE_BYTE | \
                         STM32_DMA_CR_PSIZE_BYTE | \
-                        STM32_DMA_CR_DIR_M2P |    /* Direction is memory to peripheral */ \
+                        STM32_DMA_CR_DIR_M2P      /* Direction is memory to peripheral */
+// Rx is not needed, but its completion means that transfer is over: no need to wait BSY
+#define VS_RX_DMA       STM32_DMA1_STREAM3
+#define VS_RX_DMA_CHNL  0
+#define VS_RX_DMA_MODE  STM32_DMA_CR_CHSEL(VS_RX_DMA_CHNL) | \
+                        DMA_PRIORITY_LOW | \
+                        STM32_DMA_CR_MSIZE_BYTE | \
+                        STM32_DMA_CR_PSIZE_BYTE | \
+                        STM32_DMA_CR_DIR_P2M |    /* Direction is peripheral to memory */ \
                         STM32_DMA_CR_TCIE         /* Enable Transmission Complete IRQ */
 
+// Chip select timings: VS needs some ns, so short spin is cheaper than timer sleep.
+// Loop iteration is 4 cycles at least: 10 of them keep 300 ns at 120 MHz.
+#define VS_CS_SETUP_LOOP    10
+#define VS_CS_HOLD_LOOP     10
+
 
 // Command codes
 #define VS_READ_OPCODE  0b00000011
@@ -61,7 +75,7 @@
 #define VS_REG_AIADDR       0x0A
 #define VS_REG_VOL          0x0B
 
-enum sndState_t {sndStopped, sndPlaying, sndWritingZeroes};
+enum sndState_t {sndStopped, sndOpening, sndPlaying, sndWritingZeroes};
 
 union VsCmd_t {
     struct {
@@ -75,23 +89,27 @@ union VsCmd_t {
 #define VS_VOLUME_STEP          4
 #define VS_INITIAL_ATTENUATION  0x33
 #define VS_CMD_BUF_SZ           4       // Number of cmds in buf
-#define VS_DATA_BUF_SZ          4096    // bytes. Must be multiply of 512.
 #define ZERO_SEQ_LEN            128     // After file end, send several zeroes
+#define VS_STOP_TIMEOUT         720     // ms; StopAndWait
 
+/* Data ring. File is read by separate thread, so VS is fed while f_read
+ * waits for SD (USB mass storage or IDStore holding semSDRW). */
+#define VS_SLOT_SZ              2048    // bytes. Must be multiply of 512: f_read goes to slot directly, bypassing sector buffer.
+#define VS_SLOT_CNT             4       // 8 KB, as two buffers before the ring
+#define VS_PREFETCH_LEVEL       3       // Reader fills ring up when fewer slots are full
+#define VS_RD_CMD_CNT           4
+#define VS_PACK_CLMT_SZ         34      // Cluster link map of clip pack: 16 fragments
 
-struct VsBuf_t {
-    uint8_t Data[VS_DATA_BUF_SZ], *PData;
-    UINT DataSz;
-    FRESULT ReadFromFile(FIL *PFile) {
-        PData = Data;   // Set pointer at beginning
-        FRESULT rslt = f_read(PFile, Data, VS_DATA_BUF_SZ, &DataSz);
-//        Uart.Printf("\rRead %u\r", DataSz);
-        return rslt;
-    }
-};
+struct VsSlot_t {
+    uint8_t Data[VS_SLOT_SZ];
+    uint32_t DataSz;
+} __attribute__ ((aligned (4)));
+
+// Reader thread commands
+enum VsRdCmd_t {vrcOpen, vrcClose, vrcFill, vrcOpenPack, vrcRelease};
 
 // Event mask to wake from IRQ
-#define VS_EVT_READ_NEXT    (eventmask_t)1
+#define VS_EVT_DATA_READY   (eventmask_t)1
 #define VS_EVT_STOP         (eventmask_t)2
 #define VS_EVT_COMPLETED    (eventmask_t)4
 #define VS_EVT_DMA_DONE     (eventmask_t)8
@@ -100,12 +118,50 @@ struct VsBuf_t {
 class Sound_t {
 private:
     Spi_t ISpi;
+    uint8_t IDummy;
     msg_t CmdBuf[VS_CMD_BUF_SZ];
     Mailbox CmdBox;
     VsCmd_t ICmd;
-    VsBuf_t Buf1, Buf2, *PBuf;
     uint32_t ZeroesCount;
-    FIL IFile;
+    // Ring: Sound thread plays slot IRdIndx, reader fills slot IWrIndx
+    VsSlot_t ISlot[VS_SLOT_CNT];
+    uint32_t IRdIndx, IRdOffset, IWrIndx;
+    volatile uint32_t IFullCnt;
+    volatile bool IEof, IStarving;
+    // Play generation: changed by Sound thread on every start and stop; reader drops data of older one
+    volatile uint8_t IPlayGen;
+    uint8_t IFillGen;
+    bool IStarted;
+    uint32_t IPosition;
+    systime_t IReqTime;     // Play request, to measure latency
+    void ILogLatency() {
+        if(IStarted) return;
+        IStarted = true;
+        Uart.Printf("Snd latency %u ms\r", (chTimeNow() - IReqTime));
+    }
+    // Reader
+    FIL IFile, *PRdFile;
+    const char* IRdFilename;    // nullptr for clip in pack
+    uint32_t IRdStart, IRdLen, IRdLeft;
+    msg_t IRdCmdBuf[VS_RD_CMD_CNT];
+    Mailbox IRdCmdBox;
+    Thread *PRdThread;
+    void IRdOpen();
+    void IRdOpenClip();
+    void IRdOpenFile();
+    void IRdFill();
+    void IRdAbort() { if(IFillGen == IPlayGen) chEvtSignal(PThread, VS_EVT_STOP); }
+    // Clip pack: opened once, clips are played by seek
+    FIL IPackFile;
+    DWORD IPackClmt[VS_PACK_CLMT_SZ];
+    const char* IPackFilename;
+    uint32_t IPackOffset, IPackSz;  // Play request
+    void IRdOpenPack();
+    Semaphore IRdReleased;      // Reader closed its files
+    // Sound thread never waits for the box. Its vrcOpen only wakes reader, request itself is here.
+    volatile bool IOpenReq;
+    volatile uint8_t IOpenGen;
+    void IRdPost(VsRdCmd_t Cmd, systime_t Timeout) { chMBPost(&IRdCmdBox, (msg_t)Cmd, Timeout); }
     bool IDmaIdle;
     int16_t IAttenuation;
     const char* IFilename;
@@ -114,9 +170,9 @@ private:
     // Pin operations
     inline void Rst_Lo()   { PinClear(VS_GPIO, VS_RST); }
     inline void Rst_Hi()   { PinSet(VS_GPIO, VS_RST); }
-    inline void XCS_Lo()   { PinClear(VS_GPIO, VS_XCS); Loop(180); }
+    inline void XCS_Lo()   { ISpi.ApplyClkChange(); PinClear(VS_GPIO, VS_XCS); Loop(VS_CS_SETUP_LOOP); }
     inline void XCS_Hi()   { PinSet(VS_GPIO, VS_XCS);  }
-    inline void XDCS_Lo()  { PinClear(VS_GPIO, VS_XDCS); Loop(360); }
+    inline void XDCS_Lo()  { ISpi.ApplyClkChange(); PinClear(VS_GPIO, VS_XDCS); Loop(VS_CS_SETUP_LOOP); }
     inline void XDCS_Hi()  { PinSet(VS_GPIO, VS_XDCS); }
     // Cmds
     uint8_t CmdRead(uint8_t AAddr, uint16_t *AData);
@@ -131,6 +187,7 @@ private:
         }
         chSysUnlock();
     }
+    void IStartDma(const void *PData, uint32_t ALength, uint32_t AMemInc);
     void PrepareToStop();
     void SendZeroes();
     void IPlayNew();
@@ -139,15 +196,32 @@ public:
     void Init();
     void Shutdown();
     void Play(const char* AFilename, uint32_t StartPosition = 0) {
+        IReqTime = chTimeNow();
+        IPackSz = 0;
         IFilename = AFilename;
         if(StartPosition & 1) StartPosition--;
         IStartPosition = StartPosition;
         chEvtSignal(PThread, VS_EVT_STOP);
     }
+    // Pack is opened in reader thread; call again after card was changed
+    void OpenPack(const char* AFilename) {
+        IPackFilename = AFilename;
+        IRdPost(vrcOpenPack, TIME_INFINITE);
+    }
+    void PlayPack(uint32_t AOffset, uint32_t ASz) {
+        IReqTime = chTimeNow();
+        IFilename = NULL;
+        IPackOffset = AOffset;
+        IPackSz = ASz;
+        chEvtSignal(PThread, VS_EVT_STOP);
+    }
     void Stop() {
         IFilename = NULL;
+        IPackSz = 0;
         chEvtSignal(PThread, VS_EVT_STOP);
     }
+    uint8_t StopAndWait(uint32_t ATimeout = VS_STOP_TIMEOUT);  // App thread only
+    void CloseFiles();  // App thread only; before remount. Pack is opened again by OpenPack.
     // 0...254
     void SetVolume(uint8_t AVolume) {
         if(AVolume == 0xFF) AVolume = 0xFE;
@@ -166,7 +240,8 @@ public:
     }
     void RegisterAppThd(Thread *PThd) { IPAppThd = PThd; }
 
-    uint32_t GetPosition() { return IFile.fptr; }
+    uint32_t GetPosition() { return IPosition; }  // Sent to VS
+    uint32_t Underruns;
 #if VS_AMPF_EXISTS
     void AmpfOn()  { PinSet(VS_AMPF_GPIO, VS_AMPF_PIN); }
     void AmpfOff() { PinClear(VS_AMPF_GPIO, VS_AMPF_PIN); }
@@ -176,6 +251,7 @@ public:
     Thread *PThread;
     void IrqDreqHandler();
     void ITask();
+    void IRdTask();
     void ISendNextData();
 };
 
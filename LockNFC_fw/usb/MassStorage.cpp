@@ -322,6 +322,7 @@ bool MassStorage_t::CmdWrite10() {
             Usb.PEpBulkOut->StartReceiveToBuf(Buf2, BytesToReceive2);
         }
         // Write Buf1 to SD
+        CardWritten = true;
         Rslt = SDWrite(BlockAddress, Buf1, BlocksToWrite1);
         if(Rslt != CH_SUCCESS) {
             Uart.Printf("Wr1 fail\r");
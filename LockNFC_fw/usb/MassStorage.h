@@ -90,6 +90,7 @@ class MassStorage_t {
 public:
     void Init();
     void Reset();
+    volatile bool CardWritten;  // Set by SCSI write in UsbOut thread, cleared by App
     // Inner Use
     void UsbOutTask();
 };
@@ -0,0 +1,114 @@
+/*
+ * bench_idstore.cpp
+ *
+ * Check() of IDStore against linear scan of RAM arrays, as base was kept before
+ * the page file: time per lookup on host and card reads per lookup, for hits and misses.
+ * Store holds ID_ACCESS_CNT Access IDs at most; larger sizes are run for the scan only.
+ * Usage: bench_idstore [N...], default sizes are 100 1000 2000 4032 10000.
+ */
+
+#include "host_util.h"
+
+#define LOOKUP_CNT  4000
+#define SCAN_MAX    10000
+
+static IDStore_t Store[8];
+static ID_Array_t<SCAN_MAX> ScanAccess;
+static ID_Array_t<ID_SECRET_CNT> ScanSecret;
+static ID_Array_t<ID_ADDER_CNT> ScanAdder;
+static ID_Array_t<ID_REMOVER_CNT> ScanRemover;
+
+// Order of checks in App before IDStore
+static IdKind_t ScanCheck(ID_t &sID) {
+    if(ScanSecret.ContainsID(sID))  return ikSecret;
+    if(ScanAccess.ContainsID(sID))  return ikAccess;
+    if(ScanAdder.ContainsID(sID))   return ikAdder;
+    if(ScanRemover.ContainsID(sID)) return ikRemover;
+    return ikNone;
+}
+
+struct Result_t {
+    double Ns;
+    double Cmds, Sectors;     // Per lookup
+    uint32_t Bad;
+};
+
+// Miss is taken next to stored MakeID(k), so misses spread over all the pages as hits do.
+// Only MakeID(k) has leading bytes of k, so changed tail makes it unknown.
+static ID_t MakeMissID(uint32_t k) {
+    ID_t ID = MakeID(k);
+    ID.ID8[6] ^= 0xFF;
+    return ID;
+}
+
+template <typename F>
+static Result_t Run(F Check, uint32_t N, bool Hits, IdKind_t Expected) {
+    srand(N);
+    ID_t IDs[LOOKUP_CNT];
+    for(uint32_t i=0; i<LOOKUP_CNT; i++) {
+        uint32_t k = (uint32_t)rand() % N;
+        IDs[i] = Hits? MakeID(k) : MakeMissID(k);
+    }
+    Result_t R = {0, 0, 0, 0};
+    DiskImgResetStats();
+    uint64_t Start = NowNs();
+    for(uint32_t i=0; i<LOOKUP_CNT; i++) if(Check(IDs[i]) != Expected) R.Bad++;
+    R.Ns = (double)(NowNs() - Start) / LOOKUP_CNT;
+    R.Cmds = (double)DiskImgStats.ReadCmds / LOOKUP_CNT;
+    R.Sectors = (double)DiskImgStats.ReadSectors / LOOKUP_CNT;
+    return R;
+}
+
+static void Print(uint32_t N, const char *Method, const char *What, Result_t R) {
+    printf("%6u | %-8s %-5s %10.0f %12.3f %10.3f\n", N, Method, What, R.Ns, R.Cmds, CardMs(R.Cmds, R.Sectors));
+}
+
+int main(int argc, char *argv[]) {
+    Uart.Quiet = true;
+    uint32_t Sizes[16] = {100, 1000, 2000, ID_ACCESS_CNT, SCAN_MAX}, SizeCnt = 5, StoreN = 0, Bad = 0;
+    if(argc > 1) {
+        SizeCnt = 0;
+        for(int i=1; i<argc and SizeCnt < countof(Sizes); i++) Sizes[SizeCnt++] = strtoul(argv[i], nullptr, 0);
+    }
+    printf("RAM: IDStore_t %u bytes, arrays of scan %u bytes for %u IDs\n",
+            (unsigned)sizeof(IDStore_t), (unsigned)(sizeof(ID_Array_t<ID_ACCESS_CNT>) + sizeof(ScanSecret) +
+                    sizeof(ScanAdder) + sizeof(ScanRemover)), ID_ACCESS_CNT);
+    printf("Per lookup, %u random lookups each\n", LOOKUP_CNT);
+    printf("%6s | %-8s %-5s %10s %12s %10s\n", "IDs", "method", "", "host ns", "card cmds", "card ms*");
+    for(uint32_t s=0; s<SizeCnt; s++) {
+        uint32_t N = MIN(Sizes[s], (uint32_t)SCAN_MAX);
+        // Small groups are full, as worst case for scan
+        ScanAccess.Erase();
+        ScanSecret.Erase();
+        ScanAdder.Erase();
+        ScanRemover.Erase();
+        for(uint32_t i=0; i<N; i++) { ID_t ID = MakeID(i); ScanAccess.Add(ID); }
+        for(uint32_t i=0; i<ID_SECRET_CNT; i++)  { ID_t ID = MakeID(50000 + i); ScanSecret.Add(ID); }
+        for(uint32_t i=0; i<ID_ADDER_CNT; i++)   { ID_t ID = MakeID(60000 + i); ScanAdder.Add(ID); }
+        for(uint32_t i=0; i<ID_REMOVER_CNT; i++) { ID_t ID = MakeID(70000 + i); ScanRemover.Add(ID); }
+        Print(N, "scan", "hit",  Run(ScanCheck, N, true,  ikAccess));
+        Print(N, "scan", "miss", Run(ScanCheck, N, false, ikNone));
+
+        if(N > ID_ACCESS_CNT or StoreN >= countof(Store)) continue;
+        CardCreate("bench_idstore.img");
+        const IniGroup_t Groups[] = {
+                {ID_GROUP_NAME_ACCESS,  0,     N},
+                {ID_GROUP_NAME_SECRET,  50000, ID_SECRET_CNT},
+                {ID_GROUP_NAME_ADDER,   60000, ID_ADDER_CNT},
+                {ID_GROUP_NAME_REMOVER, 70000, ID_REMOVER_CNT},
+        };
+        if(WriteIdIni(IDSTORE_INI_FILENAME, Groups, countof(Groups)) != OK) return 2;
+        IDStore_t &S = Store[StoreN++];
+        S.Init();
+        auto StoreCheck = [&S](ID_t &sID) { return S.Check(sID); };
+        Result_t Hit = Run(StoreCheck, N, true, ikAccess), Miss = Run(StoreCheck, N, false, ikNone);
+        Bad += Hit.Bad + Miss.Bad;
+        Print(N, "IDStore", "hit",  Hit);
+        Print(N, "IDStore", "miss", Miss);
+        chHostWaitIdle();
+    }
+    printf("* card time by command count, see host_util.h\n");
+    DiskImgClose();
+    if(Bad != 0) printf("%u lookups are wrong\n", Bad);
+    return (Bad == 0)? 0 : 1;
+}
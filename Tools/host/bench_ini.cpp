@@ -0,0 +1,71 @@
+/*
+ * bench_ini.cpp
+ *
+ * Loading Access IDs from ini file: key-by-key ReadArray, as ID_Array_t::Load did,
+ * against single pass Parse, as IDStore imports now.
+ * Usage: bench_ini [N...], default sizes are 99 5000.
+ */
+
+#include "host_util.h"
+
+static uint32_t ParsedCnt;
+static void CountHandler(void *PContext, const char *AKey, char *AValue) {
+    ID_t ID;
+    if(iniFile_t::StrToArray(AValue, ID.ID8, ID_SZ_BYTES) == OK) ParsedCnt++;
+}
+
+int main(int argc, char *argv[]) {
+    Uart.Quiet = true;
+    CardCreate("bench_ini.img");
+    uint32_t Sizes[16] = {99, 5000}, SizeCnt = 2;
+    if(argc > 1) {
+        SizeCnt = 0;
+        for(int i=1; i<argc and SizeCnt < countof(Sizes); i++) Sizes[SizeCnt++] = strtoul(argv[i], nullptr, 0);
+    }
+
+    printf("%6s | %-9s %9s %9s %10s %10s\n", "IDs", "method", "host ms", "card cmds", "sectors", "card ms*");
+    for(uint32_t s=0; s<SizeCnt; s++) {
+        uint32_t N = Sizes[s];
+        const IniGroup_t Group = {ID_GROUP_NAME_ACCESS, 0, N};
+        if(WriteIdIni("bench.ini", &Group, 1) != OK) return 2;
+
+        // ==== Key by key ====
+        if(SD.OpenRead("bench.ini") != OK) return 2;
+        DiskImgResetStats();
+        uint64_t Start = NowNs();
+        uint32_t OldCnt = 0;
+        char Key[16];
+        ID_t ID;
+        while(true) {
+            snprintf(Key, sizeof(Key), "ID%u", (unsigned)OldCnt);
+            if(SD.iniFile.ReadArray(ID_GROUP_NAME_ACCESS, Key, ID.ID8, ID_SZ_BYTES) != OK) break;
+            OldCnt++;
+        }
+        uint64_t OldNs = NowNs() - Start;
+        DiskImgStats_t Old = DiskImgStats;
+        SD.Close();
+
+        // ==== Single pass ====
+        const IniHandler_t Handler = {ID_GROUP_NAME_ACCESS, CountHandler, nullptr};
+        if(SD.OpenRead("bench.ini") != OK) return 2;
+        DiskImgResetStats();
+        ParsedCnt = 0;
+        Start = NowNs();
+        SD.iniFile.Parse(&Handler, 1);
+        uint64_t NewNs = NowNs() - Start;
+        DiskImgStats_t New = DiskImgStats;
+        SD.Close();
+
+        if(OldCnt != N or ParsedCnt != N) {
+            printf("%u IDs: %u read key by key, %u parsed\n", N, OldCnt, ParsedCnt);
+            return 1;
+        }
+        printf("%6u | %-9s %9.2f %9u %10u %10.1f\n", N, "ReadArray", OldNs / 1e6, Old.ReadCmds, Old.ReadSectors,
+                CardMs(Old.ReadCmds, Old.ReadSectors));
+        printf("%6s | %-9s %9.2f %9u %10u %10.1f\n", "", "Parse", NewNs / 1e6, New.ReadCmds, New.ReadSectors,
+                CardMs(New.ReadCmds, New.ReadSectors));
+    }
+    printf("* card time by command count, see host_util.h\n");
+    DiskImgClose();
+    return 0;
+}
@@ -0,0 +1,232 @@
+/*
+ * bench_pn.cpp
+ *
+ * pn.cpp of firmware against PN532 simulator (pn_sim.h), on kernel clock sped up.
+ * Built twice: bench_pn with pn.h as is (PN_AUTOPOLL), bench_pn_soft with software poll.
+ *   idle     - link traffic with no card: first minutes while period backs off, then per hour at slow period;
+ *   latency  - card put at random time to its CardEvt_t, taken away to EVTMSK_CARD_DISAPPEARS;
+ *   presence - link cost of one CardIsStillNear per tag type;
+ *   errors   - replies with bad DCS must all be counted in PnStats_t.
+ * Link time is modelled: NSS setup per frame and bytes at PN_SPI_MAX_FREQ_HZ; PN time is
+ * that of simulator model, host thread wakeups at sped up clock would blur measured one.
+ * Usage: bench_pn [time scale]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "pn_sim.h"
+#include "main.h"
+#include "cmd_uart.h"
+
+#ifdef PN_AUTOPOLL
+#define POLL_MODE       "autopoll"
+#else
+#define POLL_MODE       "software poll"
+#endif
+
+#define TIME_SCALE      40      // Default; PN_ACK_TIMEOUT of 27 ms is still ~0.7 ms of host time
+#define IDLE_WARM_MS    150000  // Backoff reaches slow period in PN_POLL_FAST_HOLD + 2 * PN_POLL_BACKOFF
+#define IDLE_STEADY_MS  300000
+#define TRIAL_CNT       10
+#define HOLD_MS         300     // Card stays near
+#define PRESENCE_MS     5000
+#define ERRORS_MS       30000
+#define CORRUPT_EVERY   7
+
+App_t App;
+
+static const SimCard_t Cards[] = {
+        {"Ultralight", 0x0044, 0x00, 7, {0x04, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66}},
+        {"ISO-DEP",    0x0344, 0x20, 7, {0x04, 0x21, 0x32, 0x43, 0x54, 0x65, 0x76}},
+        {"Classic",    0x0004, 0x08, 4, {0xA1, 0xB2, 0xC3, 0xD4}},
+};
+static uint32_t Misses = 0;
+
+static double LinkMs(double Frames, double Bytes) {
+    return (Frames * PN_NSS_SETUP_US + Bytes * 8e6 / PN_SPI_MAX_FREQ_HZ) / 1000;
+}
+
+static void GetPnStats(PnStats_t *PStats) {
+    chSysLock();
+    memcpy(PStats, &Pn.Stats, sizeof(PnStats_t));
+    chSysUnlock();
+}
+
+// New period takes effect at once: autopoll is rearmed, software poll wait is cut
+static void SetPeriod(uint32_t APeriod) {
+    Pn.PollCfg.FastPeriod = APeriod;
+    Pn.SetFastPoll(false);
+    Pn.SetFastPoll(true);
+}
+
+static bool WaitEvt(eventmask_t AEvt, uint32_t ATimeout) {
+    if(chEvtWaitOneTimeout(AEvt, MS2ST(ATimeout)) != 0) return true;
+    Misses++;
+    return false;
+}
+
+static uint8_t PutAndWait(const SimCard_t *PCard, systime_t *PPut, CardEvt_t *PEvt) {
+    chEvtGetAndClearEvents(ALL_EVENTS);
+    *PPut = PnSim.PutCard(PCard);
+    if(!WaitEvt(EVTMSK_CARD_APPEARS, 4 * PN_POLL_SLOW)) return FAILURE;
+    while(Pn.CardEvtBuf.Get(PEvt) == OK);
+    return OK;
+}
+
+static void TakeAndWait(uint32_t *PLossMs) {
+    systime_t Taken = PnSim.PutCard(nullptr);
+    if(WaitEvt(EVTMSK_CARD_DISAPPEARS, 4 * PN_POLL_SLOW)) *PLossMs = chTimeNow() - Taken;
+}
+
+static void Idle() {
+    PnSimStats_t S0, S1, S2;
+    PnSim.GetStats(&S0);
+    chThdSleepMilliseconds(IDLE_WARM_MS);
+    PnSim.GetStats(&S1);
+    chThdSleepMilliseconds(IDLE_STEADY_MS);
+    PnSim.GetStats(&S2);
+    double k = 3600000.0 / IDLE_STEADY_MS;
+    double Frames = (S2.Frames - S1.Frames) * k, Transfers = (S2.Transfers - S1.Transfers) * k;
+    double Bytes = (S2.Bytes - S1.Bytes) * k, Polls = (S2.RfPolls - S1.RfPolls) * k;
+    printf("Idle, no card\n");
+    printf("%-14s | %9s %9s %9s %8s %9s\n", "", "frames", "transfers", "bytes", "RF polls", "link ms");
+    printf("%-14s | %9u %9u %9u %8u %9.1f\n", "first 150 s", S1.Frames - S0.Frames, S1.Transfers - S0.Transfers,
+            S1.Bytes - S0.Bytes, S1.RfPolls - S0.RfPolls, LinkMs(S1.Frames - S0.Frames, S1.Bytes - S0.Bytes));
+    printf("%-14s | %9.0f %9.0f %9.0f %8.0f %9.1f\n", "per hour, slow", Frames, Transfers, Bytes, Polls, LinkMs(Frames, Bytes));
+}
+
+static void Latency() {
+    const uint32_t Periods[] = {PN_POLL_FAST, PN_POLL_INTERVAL, PN_POLL_SLOW};
+    printf("\nCard put at random time and taken away after %u ms, %u times per period\n", HOLD_MS, TRIAL_CNT);
+    printf("%-9s | %9s %9s %9s %9s\n", "period ms", "found avg", "found max", "fw est", "lost avg");
+    Pn.SetFastPoll(true);
+    for(uint32_t p=0; p<countof(Periods); p++) {
+        SetPeriod(Periods[p]);
+        uint32_t HitCnt = Pn.HitCnt, LatencySum = Pn.LatencySum;
+        uint32_t Found = 0, FoundSum = 0, FoundMax = 0, Lost = 0, LostSum = 0;
+        for(uint32_t t=0; t<TRIAL_CNT; t++) {
+            chThdSleepMilliseconds(Periods[p] / 2 + Random(Periods[p] * 2));
+            systime_t Put;
+            CardEvt_t Evt;
+            if(PutAndWait(&Cards[0], &Put, &Evt) == OK) {
+                uint32_t Ms = Evt.Time - Put;
+                Found++;
+                FoundSum += Ms;
+                if(Ms > FoundMax) FoundMax = Ms;
+            }
+            chThdSleepMilliseconds(HOLD_MS);
+            uint32_t LossMs = 0;
+            TakeAndWait(&LossMs);
+            if(LossMs != 0) {
+                Lost++;
+                LostSum += LossMs;
+            }
+        }
+        HitCnt = Pn.HitCnt - HitCnt;
+        LatencySum = Pn.LatencySum - LatencySum;
+        printf("%-9u | %9u %9u %9u %9u\n", Periods[p], (Found == 0)? 0 : FoundSum / Found, FoundMax,
+                (HitCnt == 0)? 0 : LatencySum / HitCnt, (Lost == 0)? 0 : LostSum / Lost);
+    }
+}
+
+static void Presence() {
+    printf("\nOne presence check at period %u ms\n", PN_POLL_FAST);
+    printf("%-10s | %-17s %6s %9s %6s %8s %8s\n", "tag", "command", "frames", "transfers", "bytes", "link ms", "PN ms");
+    SetPeriod(PN_POLL_FAST);
+    for(uint32_t c=0; c<countof(Cards); c++) {
+        const SimCard_t *PCard = &Cards[c];
+        systime_t Put;
+        CardEvt_t Evt;
+        if(PutAndWait(PCard, &Put, &Evt) != OK) continue;
+        chThdSleepMilliseconds(PN_POLL_FAST);
+        PnSimStats_t S0, S1;
+        PnSim.GetStats(&S0);
+        chThdSleepMilliseconds(PRESENCE_MS);
+        PnSim.GetStats(&S1);
+        const char *Name;
+        uint8_t CmdID;
+        if(PCard->SelRes & 0x20) {
+            Name = "Diagnose";
+            CmdID = PN_CMD_DIAGNOSE;
+        }
+        else if(PCard->SelRes == 0x00) {
+            Name = "CommunicateThru";
+            CmdID = PN_CMD_IN_COMMUNICATE_THRU;
+        }
+        else {
+            Name = "Deselect+Select";
+            CmdID = PN_CMD_IN_SELECT;
+        }
+        uint32_t Checks = S1.Cmds[CmdID] - S0.Cmds[CmdID];
+        if(Checks == 0) {
+            printf("%-10s | no checks\n", PCard->Name);
+            Misses++;
+        }
+        else {
+            double Frames = (double)(S1.Frames - S0.Frames) / Checks, Bytes = (double)(S1.Bytes - S0.Bytes) / Checks;
+            printf("%-10s | %-17s %6.1f %9.1f %6.1f %8.2f %8.1f\n", PCard->Name, Name, Frames,
+                    (double)(S1.Transfers - S0.Transfers) / Checks, Bytes, LinkMs(Frames, Bytes), (double)(S1.PnMs - S0.PnMs) / Checks);
+        }
+        uint32_t LossMs;
+        TakeAndWait(&LossMs);
+    }
+    printf("Deselect+Select was the check of every tag type before single command ones\n");
+}
+
+static bool Errors() {
+    systime_t Put;
+    CardEvt_t Evt;
+    if(PutAndWait(&Cards[0], &Put, &Evt) != OK) return false;
+    PnSimStats_t S0, S1;
+    PnStats_t P0, P1;
+    PnSim.GetStats(&S0);
+    GetPnStats(&P0);
+    chSysLock();
+    PnSim.CorruptEvery = CORRUPT_EVERY;
+    chSysUnlock();
+    uint32_t Losses = 0;
+    systime_t Start = chTimeNow();
+    while(chTimeNow() - Start < ERRORS_MS) {
+        if(chEvtWaitAnyTimeout(EVTMSK_CARD_DISAPPEARS, MS2ST(100)) != 0) Losses++;
+        while(Pn.CardEvtBuf.Get(&Evt) == OK);  // Found again
+    }
+    chSysLock();
+    PnSim.CorruptEvery = 0;
+    chSysUnlock();
+    chThdSleepMilliseconds(PN_POLL_SLOW);  // Last reply is read
+    PnSim.GetStats(&S1);
+    GetPnStats(&P1);
+    uint32_t Injected = S1.Corrupted - S0.Corrupted, Counted = P1.BadDcs - P0.BadDcs;
+    printf("\nEvery %u reply with bad DCS for %u s, card near: %u injected, %u counted, card lost %u times\n",
+            CORRUPT_EVERY, ERRORS_MS / 1000, Injected, Counted, Losses);
+    uint32_t LossMs;
+    TakeAndWait(&LossMs);
+    return Injected != 0 and Injected == Counted;
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t Scale = (argc > 1)? strtoul(argv[1], NULL, 10) : TIME_SCALE;
+    Uart.Quiet = true;
+    chHostSetTimeScale(Scale);
+    srand(1);
+    App.PThd = chThdSelf();
+    Pn.Init(&PnSim);
+    chThdSleepMilliseconds(500);    // Setup commands
+    printf("PN532 %s, time x%u\n", POLL_MODE, Scale);
+
+    Idle();
+    Latency();
+    Presence();
+    bool ErrorsOk = Errors();
+
+    PnStats_t P;
+    GetPnStats(&P);
+    PnSimStats_t S;
+    PnSim.GetStats(&S);
+    printf("\nLink: %u ACK timeouts, %u data timeouts, %u NACKs, %u bad start, %u bad frames to PN, %u aborts\n",
+            P.AckTimeouts, P.DataTimeouts, P.Nacks, P.BadStart, S.BadFrames, S.Aborts);
+    if(Misses != 0) printf("%u card events missed\n", Misses);
+    bool Ok = (Misses == 0) and ErrorsOk and S.BadFrames == 0;
+    printf("%s\n", Ok? "PASSED" : "FAILED");
+    return Ok? 0 : 1;
+}
@@ -0,0 +1,222 @@
+/*
+ * bench_sndpath.cpp
+ *
+ * Card traffic from play request to first data for VS1053, per way a clip is found:
+ *   dirscan - two passes over dir, open, two 4 KB buffers read (SndList_t before index);
+ *   index   - open by 8.3 name from index, first slot read (SndList_t::IIndexDir path);
+ *   pack    - seek in pack opened once with link map, first slot read (Sound_t::IRdOpenClip).
+ * FatFs call sequences of the firmware are replayed on card image with clips of SDCard folder.
+ * Usage: bench_sndpath <SDCard dir> <sounds.pak>
+ */
+
+#include <strings.h>
+#include <filesystem>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include "host_util.h"
+#include "Soundlist.h"
+
+#define OLD_BUF_SZ      4096    // VS_DATA_BUF_SZ before reader thread
+#define SLOT_SZ         2048    // VS_SLOT_SZ of sound.h
+#define PACK_CLMT_SZ    34      // VS_PACK_CLMT_SZ of sound.h
+#define PLAY_CNT        60      // Requests per group
+
+static const char *Groups[] = {"GoodKey", "BadKey", "Closing", "Secret"};
+static uint8_t Buf[2][OLD_BUF_SZ];
+static FIL File, PackFile;
+static DIR Dir;
+static FILINFO FileInfo;
+static char LfnBuf[MAX_NAME_LEN];
+
+#if 1 // ==== Card setup ====
+static uint8_t CopyFile(const char *ASrc, const char *ADst) {
+    FILE *f = fopen(ASrc, "rb");
+    if(f == nullptr) return FAILURE;
+    uint8_t Rslt = FAILURE;
+    if(f_open(&File, ADst, FA_WRITE+FA_CREATE_ALWAYS) == FR_OK) {
+        Rslt = OK;
+        size_t Len;
+        UINT Done;
+        while((Len = fread(Buf[0], 1, OLD_BUF_SZ, f)) != 0) {
+            if(f_write(&File, Buf[0], Len, &Done) != FR_OK or Done != Len) { Rslt = FAILURE; break; }
+        }
+        f_close(&File);
+    }
+    fclose(f);
+    return Rslt;
+}
+
+static uint8_t CopyGroups(const char *ARoot) {
+    for(uint32_t g=0; g<countof(Groups); g++) {
+        std::string Path = std::string(ARoot) + "/" + Groups[g];
+        std::error_code Err;
+        std::vector<std::string> Names;
+        for(auto &e : std::filesystem::directory_iterator(Path, Err)) Names.push_back(e.path().filename().string());
+        if(Err) return FAILURE;
+        std::sort(Names.begin(), Names.end());
+        f_mkdir(Groups[g]);
+        for(auto &Name : Names) {
+            if(CopyFile((Path + "/" + Name).c_str(), (std::string(Groups[g]) + "/" + Name).c_str()) != OK) return FAILURE;
+        }
+    }
+    return OK;
+}
+#endif
+
+#if 1 // ==== Ways to the clip ====
+static bool IsPlayable(const char *FName) {
+    uint32_t Len = strlen(FName);
+    return Len > 4 and ((strcasecmp(&FName[Len-3], "mp3") == 0) or (strcasecmp(&FName[Len-3], "wav") == 0));
+}
+
+// SndList_t::CountFilesInDir and PlayRandomFileFromDir of first version, then Sound_t::IPlayNew
+static uint8_t PlayDirScan(const char *DirName, uint32_t N) {
+    FileInfo.lfname = LfnBuf;
+    FileInfo.lfsize = sizeof(LfnBuf);
+    uint32_t Cnt = 0;
+    if(f_opendir(&Dir, DirName) != FR_OK) return FAILURE;
+    while(f_readdir(&Dir, &FileInfo) == FR_OK and (FileInfo.fname[0] != 0 or FileInfo.lfname[0] != 0)) {
+        char *FName = (FileInfo.lfname[0] == 0)? FileInfo.fname : FileInfo.lfname;
+        if(!(FileInfo.fattrib & AM_DIR) and IsPlayable(FName)) Cnt++;
+    }
+    if(Cnt == 0) return FAILURE;
+    N %= Cnt;
+    uint32_t Counter = 0;
+    if(f_opendir(&Dir, DirName) != FR_OK) return FAILURE;
+    while(f_readdir(&Dir, &FileInfo) == FR_OK and (FileInfo.fname[0] != 0 or FileInfo.lfname[0] != 0)) {
+        char *FName = (FileInfo.lfname[0] == 0)? FileInfo.fname : FileInfo.lfname;
+        if((FileInfo.fattrib & AM_DIR) or !IsPlayable(FName)) continue;
+        if(Counter++ != N) continue;
+        char Filename[MAX_NAME_LEN];
+        snprintf(Filename, sizeof(Filename), "%s/%s", DirName, FName);
+        if(f_open(&File, Filename, FA_READ+FA_OPEN_EXISTING) != FR_OK) return FAILURE;
+        UINT Sz = 0;
+        f_read(&File, Buf[0], OLD_BUF_SZ, &Sz);
+        if(Sz == OLD_BUF_SZ) f_read(&File, Buf[1], OLD_BUF_SZ, &Sz);
+        f_close(&File);
+        return OK;
+    }
+    return FAILURE;
+}
+
+// Index holds 8.3 names: Sound_t::IRdOpenFile, then first IRdFill slot
+static uint8_t PlayIndexed(const char *Filename) {
+    if(f_open(&File, Filename, FA_READ+FA_OPEN_EXISTING) != FR_OK) return FAILURE;
+    UINT Sz = 0;
+    f_read(&File, Buf[0], SLOT_SZ, &Sz);
+    f_close(&File);
+    return (Sz != 0)? OK : FAILURE;
+}
+
+// Sound_t::IRdOpenClip, then first IRdFill slot
+static uint8_t PlayPacked(uint32_t Offset, uint32_t Len) {
+    if(f_lseek(&PackFile, Offset) != FR_OK or PackFile.fptr != Offset) return FAILURE;
+    UINT Sz = SLOT_SZ - (PackFile.fptr % 512), Done = 0;
+    if(Sz > Len) Sz = Len;
+    f_read(&PackFile, Buf[0], Sz, &Done);
+    return (Done == Sz)? OK : FAILURE;
+}
+#endif
+
+struct Clip_t {
+    uint32_t Group;
+    std::string Name;   // 8.3
+    uint32_t Offset, Sz;
+};
+
+struct Stat_t {
+    uint32_t Plays;
+    DiskImgStats_t Card;
+    uint64_t Ns;
+    void Begin() { DiskImgResetStats(); Ns -= NowNs(); }
+    void End() {
+        Ns += NowNs();
+        Plays++;
+        Card.ReadCmds += DiskImgStats.ReadCmds;
+        Card.ReadSectors += DiskImgStats.ReadSectors;
+    }
+    void Print(const char *Name) {
+        if(Plays == 0) { printf("%-8s | %s\n", Name, "not used by these clips"); return; }
+        double Cmds = (double)Card.ReadCmds / Plays, Sectors = (double)Card.ReadSectors / Plays;
+        printf("%-8s | %9.1f %9.1f %9.1f %10.1f\n", Name, Ns / 1e3 / Plays, Cmds, Sectors, CardMs(Cmds, Sectors));
+    }
+};
+
+int main(int argc, char *argv[]) {
+    if(argc < 3) {
+        fprintf(stderr, "Usage: %s <SDCard dir> <sounds.pak>\n", argv[0]);
+        return 2;
+    }
+    Uart.Quiet = true;
+    CardCreate("bench_sndpath.img");
+    if(CopyGroups(argv[1]) != OK or CopyFile(argv[2], SND_PACK_FILENAME) != OK) {
+        fprintf(stderr, "Cannot put clips on card\n");
+        return 2;
+    }
+
+    // ==== Index, as SndList_t::Rebuild makes it ====
+    std::vector<Clip_t> Clips;
+    FileInfo.lfname = nullptr;
+    FileInfo.lfsize = 0;
+    for(uint32_t g=0; g<countof(Groups); g++) {
+        if(f_opendir(&Dir, Groups[g]) != FR_OK) return 2;
+        while(f_readdir(&Dir, &FileInfo) == FR_OK and FileInfo.fname[0] != 0) {
+            if(!(FileInfo.fattrib & AM_DIR) and IsPlayable(FileInfo.fname)) Clips.push_back({g, FileInfo.fname, 0, FileInfo.fsize});
+        }
+    }
+    // Pack table, and link map as Sound_t::IRdOpenPack makes it
+    static DWORD Clmt[PACK_CLMT_SZ];
+    SndPackHdr_t Hdr;
+    UINT Done;
+    if(f_open(&PackFile, SND_PACK_FILENAME, FA_READ+FA_OPEN_EXISTING) != FR_OK or
+            f_read(&PackFile, &Hdr, sizeof(Hdr), &Done) != FR_OK or Hdr.Magic != SND_PACK_MAGIC) return 2;
+    std::vector<Clip_t> Packed;
+    for(uint32_t i=0; i<Hdr.ClipCnt; i++) {
+        SndPackEntry_t Entry;
+        if(f_read(&PackFile, &Entry, sizeof(Entry), &Done) != FR_OK or Done != sizeof(Entry)) return 2;
+        for(uint32_t g=0; g<countof(Groups); g++) {
+            if(strncasecmp(Entry.Group, Groups[g], SND_PACK_GROUP_SZ) == 0) Packed.push_back({g, "", Entry.Offset, Entry.Length});
+        }
+    }
+    Clmt[0] = PACK_CLMT_SZ;
+    PackFile.cltbl = Clmt;
+    if(f_lseek(&PackFile, CREATE_LINKMAP) != FR_OK) PackFile.cltbl = 0;
+
+    // ==== Requests ====
+    Stat_t Scan = {}, Index = {}, Pack = {};
+    srand(1);
+    for(uint32_t i=0; i<PLAY_CNT * countof(Groups); i++) {
+        uint32_t g = i % countof(Groups), r = (uint32_t)rand();
+        std::vector<uint32_t> InGroup, InPack;
+        for(uint32_t j=0; j<Clips.size(); j++) if(Clips[j].Group == g) InGroup.push_back(j);
+        for(uint32_t j=0; j<Packed.size(); j++) if(Packed[j].Group == g) InPack.push_back(j);
+        if(InGroup.empty()) continue;
+        uint32_t n = r % InGroup.size();
+        Scan.Begin();
+        if(PlayDirScan(Groups[g], n) != OK) return 1;
+        Scan.End();
+        Clip_t &c = Clips[InGroup[n]];
+        std::string Filename = std::string(Groups[g]) + "/" + c.Name;
+        Index.Begin();
+        if(PlayIndexed(Filename.c_str()) != OK) return 1;
+        Index.End();
+        if(!InPack.empty()) {
+            Clip_t &p = Packed[InPack[r % InPack.size()]];
+            Pack.Begin();
+            if(PlayPacked(p.Offset, p.Sz) != OK) return 1;
+            Pack.End();
+        }
+    }
+
+    printf("%u clips in dirs, %u in pack\n", (unsigned)Clips.size(), (unsigned)Packed.size());
+    printf("Per play request, to first data for VS1053\n");
+    printf("%-8s | %9s %9s %9s %10s\n", "way", "host us", "card cmds", "sectors", "card ms*");
+    Scan.Print("dirscan");
+    Index.Print("index");
+    Pack.Print("pack");
+    printf("* card time by command count, see host_util.h\n");
+    f_close(&PackFile);
+    DiskImgClose();
+    return 0;
+}
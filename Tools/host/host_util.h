@@ -0,0 +1,90 @@
+/*
+ * host_util.h
+ *
+ * Common parts of host tests and benchmarks: card image, IDs, ini writer, timing.
+ */
+
+#ifndef HOST_UTIL_H_
+#define HOST_UTIL_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "kl_sd.h"
+#include "diskimg.h"
+#include "IDStore.h"
+
+// Fresh card of 32 MB with empty FAT16 volume, mounted as target does at boot
+static inline void CardCreate(const char *AFilename) {
+    if(DiskImgCreate(AFilename, 32) != OK) exit(2);
+    SD.Init();
+    if(!SD.IsReady) {
+        fprintf(stderr, "%s: card is not ready\n", AFilename);
+        exit(2);
+    }
+}
+
+// 7-byte UID as Ultralight has, first byte is NXP manufacturer code
+static inline ID_t MakeID(uint32_t N) {
+    ID_t ID;
+    uint32_t h = N * 2654435761u;
+    ID.ID8[0] = 0x04;
+    ID.ID8[1] = (uint8_t)(N >> 16);
+    ID.ID8[2] = (uint8_t)(N >> 8);
+    ID.ID8[3] = (uint8_t)N;
+    ID.ID8[4] = (uint8_t)(h >> 24);
+    ID.ID8[5] = (uint8_t)(h >> 16);
+    ID.ID8[6] = (uint8_t)(h >> 8);
+    ID.ID8[7] = 0;
+    return ID;
+}
+
+#if 1 // ==== Ini file ====
+struct IniGroup_t {
+    const char *Name;
+    uint32_t First, Cnt;    // IDs MakeID(First)...MakeID(First+Cnt-1)
+};
+
+static inline uint8_t WriteIdIni(const char *AFilename, const IniGroup_t *PGroup, uint32_t GroupCnt) {
+    if(SD.OpenRewrite(AFilename) != OK) {
+        fprintf(stderr, "%s: cannot create\n", AFilename);
+        return FAILURE;
+    }
+    char S[64];
+    UINT Done;
+    for(uint32_t g=0; g<GroupCnt; g++) {
+        int Len = snprintf(S, sizeof(S), "[%s]\r\n", PGroup[g].Name);
+        f_write(&SD.File, S, Len, &Done);
+        for(uint32_t i=0; i<PGroup[g].Cnt; i++) {
+            ID_t ID = MakeID(PGroup[g].First + i);
+            Len = snprintf(S, sizeof(S), "ID%u=", (unsigned)i);
+            for(uint32_t j=0; j<ID_SZ_BYTES; j++) Len += snprintf(&S[Len], sizeof(S) - Len, "%02X", ID.ID8[j]);
+            Len += snprintf(&S[Len], sizeof(S) - Len, "\r\n");
+            if(f_write(&SD.File, S, Len, &Done) != FR_OK or Done != (UINT)Len) {
+                fprintf(stderr, "%s: write error\n", AFilename);
+                SD.Close();
+                return FAILURE;
+            }
+        }
+        f_write(&SD.File, "\r\n", 2, &Done);
+    }
+    SD.Close();
+    return OK;
+}
+#endif
+
+#if 1 // ==== Timing ====
+static inline uint64_t NowNs() {
+    struct timespec Ts;
+    clock_gettime(CLOCK_MONOTONIC, &Ts);
+    return (uint64_t)Ts.tv_sec * 1000000000ull + Ts.tv_nsec;
+}
+
+// Card time by command count: SDIO 4 bit at 24 MHz moves a sector in ~25 us,
+// and card answers read command in 0.1...1 ms; 0.3 ms is taken as typical.
+#define CARD_CMD_US         300
+#define CARD_SECTOR_US      25
+static inline double CardMs(double Cmds, double Sectors) { return (Cmds * CARD_CMD_US + Sectors * CARD_SECTOR_US) / 1000; }
+#endif
+
+#endif /* HOST_UTIL_H_ */
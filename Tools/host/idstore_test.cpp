@@ -0,0 +1,159 @@
+/*
+ * idstore_test.cpp
+ *
+ * IDStore on card image: ini import, runtime edits, journal replay, batches,
+ * remount and erase. Every stage is checked against a model, then again
+ * after the base is loaded from the card by a fresh store, as after reboot.
+ */
+
+#include <map>
+#include "host_util.h"
+
+#define ID_SPAN     1200    // IDs MakeID(0)...MakeID(ID_SPAN-1) are checked
+
+static std::map<uint32_t, IdKind_t> Model;
+static IDStore_t Store[8];      // New one for every reload
+static uint32_t StoreN = 0, Errors = 0;
+
+static IDStore_t& Reload() {
+    chHostWaitIdle();
+    if(StoreN >= countof(Store)) exit(2);
+    IDStore_t &S = Store[StoreN++];
+    S.Init();
+    return S;
+}
+
+// Writer thread has written everything and the switch to new base is done
+static void Settle(IDStore_t &S) {
+    chHostWaitIdle();
+    S.CompactIfNeeded();
+    chHostWaitIdle();
+    S.CompactIfNeeded();
+}
+
+static void Verify(IDStore_t &S, const char *Stage) {
+    uint32_t Bad = 0;
+    for(uint32_t n=0; n<ID_SPAN; n++) {
+        ID_t ID = MakeID(n);
+        auto it = Model.find(n);
+        IdKind_t Expected = (it == Model.end())? ikNone : it->second;
+        IdKind_t Got = S.Check(ID);
+        if(Got != Expected) {
+            if(Bad < 5) printf("  %s: ID %u is %u, expected %u\n", Stage, n, Got, Expected);
+            Bad++;
+        }
+    }
+    printf("%-28s %s\n", Stage, (Bad == 0)? "ok" : "FAILED");
+    if(Bad != 0) Errors++;
+}
+
+static bool FileExists(const char *AFilename) {
+    FILINFO FInfo;
+    FInfo.lfname = nullptr;
+    FInfo.lfsize = 0;
+    return f_stat(AFilename, &FInfo) == FR_OK;
+}
+
+// Delta may be full for a moment while writer folds it into pages: App would get FAILURE
+// and the key would be presented again.
+static void Edit(IDStore_t &S, uint32_t N, IdKind_t Kind, bool Add) {
+    ID_t ID = MakeID(N);
+    for(uint32_t i=0; i<3; i++) {
+        if((Add? S.Add(ID, Kind) : S.Remove(ID, Kind)) == OK) {
+            if(Add) Model[N] = Kind;
+            else Model.erase(N);
+            return;
+        }
+        chHostWaitIdle();
+    }
+    printf("  ID %u: %s failed\n", N, Add? "add" : "remove");
+    Errors++;
+}
+
+int main() {
+    Uart.Quiet = true;
+    CardCreate("idstore_test.img");
+
+    // ==== Import ====
+    const IniGroup_t Groups[] = {
+            {ID_GROUP_NAME_ACCESS,  0,   300},
+            {ID_GROUP_NAME_ADDER,   300, 2},
+            {ID_GROUP_NAME_REMOVER, 302, 2},
+            {ID_GROUP_NAME_SECRET,  304, 1},
+    };
+    if(WriteIdIni(IDSTORE_INI_FILENAME, Groups, countof(Groups)) != OK) return 2;
+    for(uint32_t n=0; n<300; n++) Model[n] = ikAccess;
+    Model[300] = Model[301] = ikAdder;
+    Model[302] = Model[303] = ikRemover;
+    Model[304] = ikSecret;
+    IDStore_t *S = &Reload();
+    Verify(*S, "ini import");
+    if(FileExists(IDSTORE_INI_FILENAME) or !FileExists(IDSTORE_INI_IMPORTED)) {
+        printf("ini file is not renamed\n");
+        Errors++;
+    }
+    Verify(Reload(), "import reloaded");
+    S = &Store[StoreN - 1];
+
+    // ==== Runtime edits, delta is folded into pages on the fly ====
+    for(uint32_t n=400; n<480; n++) Edit(*S, n, ikAccess, true);
+    for(uint32_t n=0; n<300; n+=10) Edit(*S, n, ikAccess, false);
+    Edit(*S, 500, ikAdder, true);
+    Edit(*S, 300, ikAdder, false);
+    Edit(*S, 501, ikRemover, true);
+    Verify(*S, "runtime edits");
+    Settle(*S);
+    Verify(*S, "runtime edits saved");
+    S = &Reload();
+    Verify(*S, "runtime edits reloaded");
+
+    // ==== Few edits stay in journal ====
+    for(uint32_t n=600; n<605; n++) Edit(*S, n, ikAccess, true);
+    Edit(*S, 5, ikAccess, false);
+    Edit(*S, 502, ikRemover, true);
+    chHostWaitIdle();
+    if(!FileExists(IDSTORE_JOURNAL_FILENAME)) {
+        printf("journal is not written\n");
+        Errors++;
+    }
+    S = &Reload();
+    Verify(*S, "journal replayed");
+
+    // ==== Batches ====
+    ID_t IDs[ID_BATCH_MAX_CNT];
+    for(uint32_t i=0; i<150; i++) IDs[i] = MakeID(700 + i);
+    if(S->AddMany(IDs, 150, ikAccess) != OK) Errors++;
+    for(uint32_t i=0; i<150; i++) Model[700 + i] = ikAccess;
+    Settle(*S);
+    for(uint32_t i=0; i<50; i++) {
+        IDs[i] = MakeID(1 + i * 2);
+        Model.erase(1 + i * 2);
+    }
+    if(S->RemoveMany(IDs, 50, ikAccess) != OK) Errors++;
+    Verify(*S, "batches");
+    Settle(*S);
+    S = &Reload();
+    Verify(*S, "batches reloaded");
+
+    // ==== Remount, as after USB disconnect ====
+    S->Pause();
+    SD.Remount();
+    S->Resume();
+    Verify(*S, "remounted");
+    Edit(*S, 900, ikAccess, true);
+    Verify(*S, "edit after remount");
+
+    // ==== Erase ====
+    S->EraseAll();
+    for(auto it = Model.begin(); it != Model.end(); ) {
+        if(it->second != ikSecret) it = Model.erase(it);
+        else ++it;
+    }
+    Verify(*S, "erased");
+    Settle(*S);
+    Verify(Reload(), "erased reloaded");
+
+    DiskImgClose();
+    printf("%s\n", (Errors == 0)? "PASSED" : "FAILED");
+    return (Errors == 0)? 0 : 1;
+}
@@ -0,0 +1,357 @@
+/*
+ * pn_sim.cpp
+ *
+ * PN532 simulator, see pn_sim.h.
+ */
+
+#include "pn_sim.h"
+
+PnSim_t PnSim;
+
+static WORKING_AREA(waPnSimThread, 256);
+__attribute__ ((__noreturn__))
+static void PnSimThread(void *arg) {
+    chRegSetThreadName("PnSim");
+    PnSim.ITask();
+}
+
+void PnSim_t::Init() {
+    ISimThd = chThdCreateStatic(waPnSimThread, sizeof(waPnSimThread), NORMALPRIO, (tfunc_t)PnSimThread, NULL);
+}
+
+void PnSim_t::HwReset() {
+    chSysLock();
+    IState = ssIdle;
+    IIrqEnabled = false;
+    ITgActive = false;
+    chSysUnlock();
+    chThdSleepMilliseconds(18);     // As PnSpi_t::HwReset does
+}
+
+__attribute__ ((__noreturn__))
+void PnSim_t::ITask() {
+    while(true) {
+        chSysLock();
+        systime_t Wait = IProcessI(chTimeNow());
+        chSysUnlock();
+        if(Wait != TIME_IMMEDIATE) chEvtWaitAnyTimeout(EVENT_MASK(0), Wait);
+    }
+}
+
+// Moves PN along when its time comes; returns time to next step
+systime_t PnSim_t::IProcessI(systime_t Now) {
+    switch(IState) {
+        case ssAck:
+        case ssCmd:
+            if((int32_t)(IReadyAt - Now) > 0) return IReadyAt - Now;
+            if(IState == ssAck) {
+                memcpy(IOutBuf, &PnPktAck, PN_ACK_NACK_SZ);
+                IOutLen = PN_ACK_NACK_SZ;
+                IState = ssAckOut;
+            }
+            else if(IReplyI()) IState = ssReplyOut;
+            else return TIME_IMMEDIATE;     // Autopoll lost its card before reply
+            if(IIrqEnabled) IIrqI();
+            return TIME_INFINITE;
+
+        case ssAutoPoll:
+            if((int32_t)(INextPoll - Now) > 0) return INextPoll - Now;
+            Stats.RfPolls++;
+            if(PCard != nullptr) {
+                IState = ssCmd;
+                IReadyAt = INextPoll + SIM_ACTIVATE_MS;
+            }
+            else INextPoll += IAutoPeriod;
+            return TIME_IMMEDIATE;
+
+        default: return TIME_INFINITE;
+    }
+}
+
+#if 1 // ============================== Link =====================================
+void PnSim_t::Select() {
+    chSysLock();
+    IFirstByte = true;
+    IWrLen = 0;
+    Stats.Frames++;
+    chSysUnlock();
+}
+
+void PnSim_t::Deselect() {
+    chSysLock();
+    if(!IFirstByte) {
+        if(!IDirRead) IFrameInI();
+        else if(IReadOut) IOutDoneI();
+    }
+    chSysUnlock();
+}
+
+// First byte of frame tells direction (um p.45); then host bytes are taken or PN bytes given
+uint8_t PnSim_t::TxRx(void *PTx, void *PRx, uint32_t ALength) {
+    uint8_t *PT = (uint8_t*)PTx, *PR = (uint8_t*)PRx;
+    chSysLock();
+    Stats.Transfers++;
+    Stats.Bytes += ALength;
+    for(uint32_t i=0; i<ALength; i++) {
+        uint8_t b = PT[i], r = 0;
+        if(IFirstByte) {
+            IFirstByte = false;
+            IDirRead = (b == PN_PRE_DATA_READ);
+            IReadOut = IDirRead and IOutReady();
+            IRdIndx = 0;
+            r = 0xFF;
+        }
+        else if(IDirRead) r = (IReadOut and IRdIndx < IOutLen)? IOutBuf[IRdIndx++] : 0x00;
+        else if(IWrLen < sizeof(IWrBuf)) IWrBuf[IWrLen++] = b;
+        if(PR != nullptr) PR[i] = r;
+    }
+    chSysUnlock();
+    return OK;
+}
+
+// IRQ pin is low while ACK or reply waits: it fires at once if enabled then
+void PnSim_t::EnableReadyIrq() {
+    chSysLock();
+    IIrqEnabled = true;
+    if(IOutReady()) IIrqI();
+    chSysUnlock();
+}
+#endif
+
+#if 1 // ============================= Frames ====================================
+// Host frame is complete: ACK aborts command, command frame is ACKed and run
+void PnSim_t::IFrameInI() {
+    uint8_t *p = IWrBuf;
+    if(IWrLen < 6 or p[0] != 0x00 or p[1] != 0x00 or p[2] != 0xFF) {
+        Stats.BadFrames++;
+        return;
+    }
+    if(p[3] == 0x00 and p[4] == 0xFF) {
+        Stats.Aborts++;
+        IState = ssIdle;
+        return;
+    }
+    uint8_t *PData;
+    uint32_t Len;
+    if(p[3] == 0xFF and p[4] == 0xFF) {     // Extended
+        if(IWrLen < 9 or (uint8_t)(p[5] + p[6] + p[7]) != 0) {
+            Stats.BadFrames++;
+            return;
+        }
+        Len = BuildUint16(p[6], p[5]);
+        PData = &p[8];
+    }
+    else {
+        if((uint8_t)(p[3] + p[4]) != 0) {
+            Stats.BadFrames++;
+            return;
+        }
+        Len = p[3];
+        PData = &p[5];
+    }
+    if(Len < 2 or (uint32_t)(PData - p) + Len + 1 > IWrLen or PData[0] != PN_FRAME_TFI_TRANSMIT) {
+        Stats.BadFrames++;
+        return;
+    }
+    uint8_t Dcs = 0;
+    for(uint32_t i=0; i<=Len; i++) Dcs += PData[i];     // TFI, data and DCS
+    if(Dcs != 0) {
+        Stats.BadFrames++;
+        return;
+    }
+    ICmdLen = Len - 1;
+    memcpy(ICmd, &PData[1], ICmdLen);
+    Stats.Cmds[ICmd[0]]++;
+    IState = ssAck;
+    IReadyAt = chTimeNow() + SIM_ACK_MS;
+    Stats.PnMs += SIM_ACK_MS;
+    IWakeI();
+}
+
+// Host has read what was out: command runs after its ACK
+void PnSim_t::IOutDoneI() {
+    if(IState == ssAckOut) IStartCmdI(chTimeNow());
+    else if(IState == ssReplyOut) IState = ssIdle;
+}
+
+void PnSim_t::IStartCmdI(systime_t Now) {
+    uint32_t Duration;
+    bool Near = (PCard != nullptr);
+    switch(ICmd[0]) {
+        case PN_CMD_IN_AUTO_POLL:   // PollNr, Period, Type1
+            IAutoPeriod = ICmd[2] * SIM_AUTOPOLL_UNIT;
+            INextPoll = Now;
+            IState = ssAutoPoll;
+            IWakeI();
+            return;
+        case PN_CMD_IN_LIST_PASSIVE_TARGET:
+            Stats.RfPolls++;
+            Duration = Near? SIM_ACTIVATE_MS : SIM_LIST_EMPTY_MS;
+            break;
+        case PN_CMD_IN_DATA_EXCHANGE:
+        case PN_CMD_IN_COMMUNICATE_THRU:
+        case PN_CMD_DIAGNOSE:
+            Duration = (Near and ITgActive)? SIM_EXCHANGE_MS : SIM_NO_TAG_MS;
+            break;
+        case PN_CMD_IN_DESELECT: Duration = SIM_DESELECT_MS; break;
+        case PN_CMD_IN_SELECT:   Duration = Near? SIM_ACTIVATE_MS : SIM_NO_TAG_MS; break;
+        default: Duration = SIM_LOCAL_MS; break;
+    }
+    IState = ssCmd;
+    IReadyAt = Now + Duration;
+    Stats.PnMs += Duration;
+    IWakeI();
+}
+
+// Tg, SENS_RES, SEL_RES, NFCID length, NFCID
+uint32_t PnSim_t::ITargetData(uint8_t *PDst) {
+    PDst[0] = 1;
+    PDst[1] = (uint8_t)(PCard->SensRes >> 8);
+    PDst[2] = (uint8_t)PCard->SensRes;
+    PDst[3] = PCard->SelRes;
+    PDst[4] = PCard->UidLen;
+    memcpy(&PDst[5], PCard->Uid, PCard->UidLen);
+    return 5 + PCard->UidLen;
+}
+
+// Reply to command as card is now; false if there is nothing to say yet
+bool PnSim_t::IReplyI() {
+    uint8_t R[PN_MAX_DATA_SZ];
+    uint32_t n = 0;
+    bool Near = (PCard != nullptr);
+    bool Talks = Near and ITgActive;
+    R[n++] = PN_FRAME_TFI_RECIEVE;
+    R[n++] = ICmd[0] + 1;
+    switch(ICmd[0]) {
+        case PN_CMD_GET_FIRMWARE_VERSION:
+            R[n++] = 0x32; R[n++] = 0x01; R[n++] = 0x06; R[n++] = 0x07;
+            break;
+        case PN_CMD_RF_CONFIGURATION:
+            if(ICmd[1] == 0x01 and !(ICmd[2] & 0x01)) ITgActive = false;   // Field off
+            break;
+        case PN_CMD_IN_LIST_PASSIVE_TARGET:
+            R[n++] = Near? 1 : 0;
+            if(Near) {
+                n += ITargetData(&R[n]);
+                ITgActive = true;
+            }
+            break;
+        case PN_CMD_IN_AUTO_POLL:   // NbTg, Type1, Length1, TargetData1
+            if(!Near) {
+                IState = ssAutoPoll;
+                INextPoll += IAutoPeriod;
+                return false;
+            }
+            R[n++] = 1;
+            R[n++] = ICmd[3];
+            R[n] = ITargetData(&R[n+1]);
+            n += R[n] + 1;
+            ITgActive = true;
+            break;
+        case PN_CMD_IN_DATA_EXCHANGE:   // Tg, MIFARE cmd, address
+            if(!Talks) R[n++] = 0x01;   // Timeout
+            else if(PCard->SelRes & 0x20) {
+                // ISO-DEP card takes READ as INF of I-block and answers with error code of its own
+                R[n++] = 0x00;
+                R[n++] = 0x1C;
+            }
+            else {
+                uint32_t Unit = (PCard->SelRes == 0x00)? 4 : 16;    // Page or block
+                R[n++] = 0x00;
+                for(uint32_t i=0; i<16; i++) R[n++] = IMem[(ICmd[3] * Unit + i) % SIM_MEM_SZ];
+            }
+            break;
+        case PN_CMD_IN_COMMUNICATE_THRU:    // READ page or FAST_READ start, end; Type 2 tag only
+            if(!Talks or PCard->SelRes != 0x00) R[n++] = 0x01;
+            else {
+                uint32_t Start = ICmd[2] * 4, Sz = 16;
+                if(ICmd[1] == MIFARE_CMD_FAST_READ) Sz = (ICmd[3] - ICmd[2] + 1) * 4;
+                if(Sz > PN_MAX_DATA_SZ - 3) Sz = PN_MAX_DATA_SZ - 3;
+                R[n++] = 0x00;
+                for(uint32_t i=0; i<Sz; i++) R[n++] = IMem[(Start + i) % SIM_MEM_SZ];
+            }
+            break;
+        case PN_CMD_DIAGNOSE:
+            if(ICmd[1] == 0x06) R[n++] = (Talks and (PCard->SelRes & 0x20))? 0x00 : 0x01;
+            else R[n++] = 0x00;
+            break;
+        case PN_CMD_IN_DESELECT:
+            R[n++] = 0x00;
+            break;
+        case PN_CMD_IN_SELECT:
+            ITgActive = Near;
+            R[n++] = Near? 0x00 : 0x01;
+            break;
+        default: break;
+    }
+    IPutFrameI(R, n);
+    return true;
+}
+
+// Normal frame up to 255 bytes of TFI and data, extended one above
+void PnSim_t::IPutFrameI(const uint8_t *PData, uint32_t ALength) {
+    uint8_t *p = IOutBuf;
+    *p++ = 0x00;
+    *p++ = 0x00;
+    *p++ = 0xFF;
+    if(ALength > 0xFF) {
+        *p++ = 0xFF;
+        *p++ = 0xFF;
+        *p++ = (uint8_t)(ALength >> 8);
+        *p++ = (uint8_t)ALength;
+        *p++ = (uint8_t)(-((ALength >> 8) + ALength));
+    }
+    else {
+        *p++ = (uint8_t)ALength;
+        *p++ = (uint8_t)(-ALength);
+    }
+    uint8_t Dcs = 0;
+    for(uint32_t i=0; i<ALength; i++) {
+        Dcs += PData[i];
+        *p++ = PData[i];
+    }
+    Dcs = -Dcs;
+    if(CorruptEvery != 0 and (++IReplyCnt % CorruptEvery) == 0) {
+        Dcs ^= 0x55;
+        Stats.Corrupted++;
+    }
+    *p++ = Dcs;
+    *p++ = 0x00;    // Postamble
+    IOutLen = p - IOutBuf;
+}
+#endif
+
+#if 1 // ============================ Caller side ================================
+systime_t PnSim_t::PutCard(const SimCard_t *ACard) {
+    chSysLock();
+    PCard = ACard;
+    ITgActive = false;
+    if(ACard != nullptr) {
+        const uint8_t *u = ACard->Uid;
+        for(uint32_t i=0; i<SIM_MEM_SZ; i++) IMem[i] = (uint8_t)i;
+        if(ACard->SelRes == 0x00) {     // Type 2 tag: UID with BCCs, then lock bytes and CC
+            uint8_t Head[16] = {u[0], u[1], u[2], (uint8_t)(0x88 ^ u[0] ^ u[1] ^ u[2]),
+                    u[3], u[4], u[5], u[6], (uint8_t)(u[3] ^ u[4] ^ u[5] ^ u[6]), 0x48, 0x00, 0x00,
+                    0xE1, 0x10, 0x12, 0x00};
+            memcpy(IMem, Head, 16);
+        }
+        else {                          // Classic block 0: UID, BCC, SAK, ATQA, manufacturer data
+            memcpy(IMem, u, 4);
+            IMem[4] = u[0] ^ u[1] ^ u[2] ^ u[3];
+            IMem[5] = ACard->SelRes;
+            IMem[6] = (uint8_t)ACard->SensRes;
+            IMem[7] = (uint8_t)(ACard->SensRes >> 8);
+        }
+    }
+    systime_t Now = chTimeNow();
+    IWakeI();
+    chSysUnlock();
+    return Now;
+}
+
+void PnSim_t::GetStats(PnSimStats_t *PStats) {
+    chSysLock();
+    memcpy(PStats, &Stats, sizeof(PnSimStats_t));
+    chSysUnlock();
+}
+#endif
@@ -0,0 +1,106 @@
+/*
+ * pn_sim.h
+ *
+ * PN532 on the other side of PnTransport_t, for host runs of pn.cpp.
+ * Bytes go as over SPI of PN532 (um p.45): host writes DW frame, PN pulls IRQ
+ * when ACK is ready, then again when reply is ready; host reads them with DR byte first.
+ * Normal and extended frames are taken and given, ACK frame from host aborts command.
+ * Card in field is set by caller. PN and RF timing is modelled in kernel ms, see SIM_*_MS:
+ * orders of magnitude of PN532 at 106 kbps, not measurements.
+ */
+
+#ifndef PN_SIM_H_
+#define PN_SIM_H_
+
+#include "pn.h"
+
+// Model of PN532 timing, ms
+#define SIM_ACK_MS          1   // Frame received to ACK ready
+#define SIM_LOCAL_MS        1   // Command with no RF: firmware version, SAM, RF configuration
+#define SIM_ACTIVATE_MS     3   // REQA, anticollision and select of one target
+#define SIM_LIST_EMPTY_MS   4   // InListPassiveTarget with nothing in field, retries included
+#define SIM_EXCHANGE_MS     2   // One exchange with active target: READ, attention request
+#define SIM_DESELECT_MS     1
+#define SIM_NO_TAG_MS       5   // Exchange with tag gone: PN gives up after retries
+#define SIM_AUTOPOLL_UNIT   PN_AUTOPOLL_UNIT
+
+#define SIM_MEM_SZ          256 // Bytes of tag memory: 64 pages of Type 2 tag, 16 blocks of Classic
+
+struct SimCard_t {
+    const char *Name;
+    uint16_t SensRes;       // ATQA
+    uint8_t SelRes;         // SAK
+    uint8_t UidLen;
+    uint8_t Uid[7];
+};
+
+// Traffic as seen on the link. Frames are NSS low periods, Transfers are TxRx calls.
+struct PnSimStats_t {
+    uint32_t Frames, Transfers, Bytes;
+    uint32_t Cmds[256];     // Command frames by command code
+    uint32_t RfPolls;       // Target searches in RF field, by InListPassiveTarget or autopoll
+    uint32_t PnMs;          // Modelled time of ACKs and commands, autopoll wait excluded
+    uint32_t Aborts;        // ACK frames from host
+    uint32_t BadFrames;     // Host frames with bad start, LCS or DCS
+    uint32_t Corrupted;     // Replies sent with bad DCS on purpose
+};
+
+// Ack and Cmd wait for IReadyAt, AckOut and ReplyOut wait for host to read, AutoPoll for card
+enum SimState_t {ssIdle, ssAck, ssAckOut, ssCmd, ssAutoPoll, ssReplyOut};
+
+class PnSim_t : public PnTransport_t {
+private:
+    Thread *ISimThd;
+    // Link
+    bool IFirstByte, IDirRead, IReadOut;
+    uint8_t IWrBuf[PN_TX_SZ(PN_MAX_DATA_SZ)];
+    uint32_t IWrLen;
+    uint8_t IOutBuf[PN_TX_SZ(PN_MAX_DATA_SZ)];
+    uint32_t IOutLen, IRdIndx;
+    bool IIrqEnabled;
+    bool IOutReady() { return IState == ssAckOut or IState == ssReplyOut; }
+    // PN
+    SimState_t IState;
+    systime_t IReadyAt;         // ACK or reply is ready then
+    systime_t INextPoll;        // Autopoll looks for card then
+    uint32_t IAutoPeriod;
+    uint8_t ICmd[PN_MAX_DATA_SZ];   // Cmd and its data, TFI excluded
+    uint32_t ICmdLen;
+    uint32_t IReplyCnt;
+    bool ITgActive;             // Target is activated and may be talked to
+    // Card
+    const SimCard_t *PCard;
+    uint8_t IMem[SIM_MEM_SZ];
+    void IFrameInI();
+    void IOutDoneI();
+    void IStartCmdI(systime_t Now);
+    systime_t IProcessI(systime_t Now);
+    bool IReplyI();
+    uint32_t ITargetData(uint8_t *PDst);
+    void IPutFrameI(const uint8_t *PData, uint32_t ALength);
+    void IIrqI() {
+        IIrqEnabled = false;
+        chEvtSignalI(PThd, EVTMSK_PN_NEW_PKT);
+    }
+    void IWakeI() { chEvtSignalI(ISimThd, EVENT_MASK(0)); }
+public:
+    PnSimStats_t Stats;
+    uint32_t CorruptEvery = 0;  // Every Nth reply gets bad DCS; 0 disables
+    // Transport
+    void Init();
+    void HwReset();
+    void Select();
+    void Deselect();
+    uint8_t TxRx(void *PTx, void *PRx, uint32_t ALength);
+    void EnableReadyIrq();
+    void DisableReadyIrqI() { IIrqEnabled = false; }
+    // Caller side
+    systime_t PutCard(const SimCard_t *ACard);  // nullptr takes card away; returns time of change
+    void GetStats(PnSimStats_t *PStats);
+    // Inner use
+    void ITask();
+};
+
+extern PnSim_t PnSim;
+
+#endif /* PN_SIM_H_ */
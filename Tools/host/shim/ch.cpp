@@ -0,0 +1,338 @@
+/*
+ * ch.cpp
+ *
+ * Host stand-in for ChibiOS/RT kernel, see ch.h.
+ */
+
+#include "ch.h"
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+struct Thread {
+    pthread_t Handle;
+    tfunc_t Func;
+    void *Arg;
+    eventmask_t Pending;
+    bool Waiting;       // Found nothing to wake it and sleeps; cleared on any wakeup
+    bool Ended;
+    Thread *Next;
+};
+
+static pthread_mutex_t SysMtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t SysCond;
+static pthread_once_t SysOnce = PTHREAD_ONCE_INIT;
+static Thread *PThreads = nullptr;      // All threads, for idle check
+static __thread Thread *PSelf = nullptr;
+static struct timespec StartTime;
+static uint32_t TimeScale = 1;      // Kernel ms per host ms
+
+static void SysInit() {
+    pthread_condattr_t Attr;
+    pthread_condattr_init(&Attr);
+    pthread_condattr_setclock(&Attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&SysCond, &Attr);
+    pthread_condattr_destroy(&Attr);
+    clock_gettime(CLOCK_MONOTONIC, &StartTime);
+}
+
+#if 1 // ==== System ====
+void chSysLock() {
+    pthread_once(&SysOnce, SysInit);
+    pthread_mutex_lock(&SysMtx);
+}
+void chSysUnlock() { pthread_mutex_unlock(&SysMtx); }
+
+systime_t chTimeNow() {
+    pthread_once(&SysOnce, SysInit);
+    struct timespec Now;
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    int64_t Ns = (int64_t)(Now.tv_sec - StartTime.tv_sec) * 1000000000LL + (Now.tv_nsec - StartTime.tv_nsec);
+    return (systime_t)(Ns * TimeScale / 1000000);
+}
+
+void *chHeapAlloc(void *heapp, size_t size) { (void)heapp; return malloc(size); }
+void chHeapFree(void *p) { free(p); }
+#endif
+
+#if 1 // ==== Inner use ====
+// Thread of caller; main thread and other foreign ones get it on first use. Lock is held.
+static Thread *ISelf() {
+    if(PSelf == nullptr) {
+        PSelf = (Thread*)calloc(1, sizeof(Thread));
+        PSelf->Handle = pthread_self();
+        PSelf->Next = PThreads;
+        PThreads = PSelf;
+    }
+    return PSelf;
+}
+
+// Sleeps until woken or deadline; returns false on timeout. Lock is held.
+static bool ISleep(const struct timespec *PDeadline) {
+    Thread *Self = ISelf();
+    Self->Waiting = true;
+    int r = (PDeadline == nullptr)? pthread_cond_wait(&SysCond, &SysMtx) :
+            pthread_cond_timedwait(&SysCond, &SysMtx, PDeadline);
+    Self->Waiting = false;
+    return r != ETIMEDOUT;
+}
+
+// Host time of Time ticks
+static void IHostTime(systime_t Time, struct timespec *PTs) {
+    uint64_t Ns = (uint64_t)Time * 1000000ULL / TimeScale;
+    PTs->tv_sec = Ns / 1000000000ULL;
+    PTs->tv_nsec = Ns % 1000000000ULL;
+}
+
+static void IDeadline(systime_t Time, struct timespec *PDeadline) {
+    struct timespec Ts;
+    IHostTime(Time, &Ts);
+    clock_gettime(CLOCK_MONOTONIC, PDeadline);
+    PDeadline->tv_sec += Ts.tv_sec;
+    PDeadline->tv_nsec += Ts.tv_nsec;
+    if(PDeadline->tv_nsec >= 1000000000L) {
+        PDeadline->tv_sec++;
+        PDeadline->tv_nsec -= 1000000000L;
+    }
+}
+
+static void IWakeAll() {
+    for(Thread *p = PThreads; p != nullptr; p = p->Next) p->Waiting = false;
+    pthread_cond_broadcast(&SysCond);
+}
+#endif
+
+#if 1 // ==== Threads ====
+static void* ThreadEntry(void *p) {
+    Thread *PThd = (Thread*)p;
+    PSelf = PThd;
+    PThd->Func(PThd->Arg);
+    chSysLock();
+    PThd->Ended = true;
+    IWakeAll();
+    chSysUnlock();
+    return nullptr;
+}
+
+Thread *chThdCreateStatic(void *wsp, size_t size, tprio_t prio, tfunc_t pf, void *arg) {
+    (void)wsp; (void)size; (void)prio;
+    Thread *PThd = (Thread*)calloc(1, sizeof(Thread));
+    PThd->Func = pf;
+    PThd->Arg = arg;
+    chSysLock();
+    PThd->Next = PThreads;
+    PThreads = PThd;
+    chSysUnlock();
+    if(pthread_create(&PThd->Handle, nullptr, ThreadEntry, PThd) != 0) {
+        perror("pthread_create");
+        abort();
+    }
+    pthread_detach(PThd->Handle);
+    return PThd;
+}
+
+Thread *chThdSelf() {
+    chSysLock();
+    Thread *PThd = ISelf();
+    chSysUnlock();
+    return PThd;
+}
+
+void chRegSetThreadName(const char *name) {
+    char S[16];
+    snprintf(S, sizeof(S), "%s", name);
+    pthread_setname_np(pthread_self(), S);
+}
+
+void chThdSleep(systime_t time) {
+    struct timespec Ts;
+    IHostTime(time, &Ts);
+    while(nanosleep(&Ts, &Ts) != 0 and errno == EINTR);
+}
+
+void chSchGoSleepS(int newstate) {
+    (void)newstate;
+    while(true) ISleep(nullptr);
+}
+#endif
+
+#if 1 // ==== Events ====
+void chEvtSignalI(Thread *tp, eventmask_t mask) {
+    tp->Pending |= mask;
+    IWakeAll();
+}
+
+void chEvtSignal(Thread *tp, eventmask_t mask) {
+    chSysLock();
+    chEvtSignalI(tp, mask);
+    chSysUnlock();
+}
+
+eventmask_t chEvtGetAndClearEvents(eventmask_t mask) {
+    chSysLock();
+    Thread *Self = ISelf();
+    eventmask_t m = Self->Pending & mask;
+    Self->Pending &= ~m;
+    chSysUnlock();
+    return m;
+}
+
+static eventmask_t IEvtWait(eventmask_t mask, systime_t time, bool One) {
+    struct timespec Deadline;
+    if(time != TIME_INFINITE) IDeadline(time, &Deadline);
+    chSysLock();
+    Thread *Self = ISelf();
+    eventmask_t m;
+    while((m = Self->Pending & mask) == 0) {
+        if(time == TIME_IMMEDIATE or !ISleep((time == TIME_INFINITE)? nullptr : &Deadline)) {
+            m = Self->Pending & mask;
+            break;
+        }
+    }
+    if(One) m &= -m;    // Lowest one
+    Self->Pending &= ~m;
+    chSysUnlock();
+    return m;
+}
+
+eventmask_t chEvtWaitOne(eventmask_t mask) { return IEvtWait(mask, TIME_INFINITE, true); }
+eventmask_t chEvtWaitAny(eventmask_t mask) { return IEvtWait(mask, TIME_INFINITE, false); }
+eventmask_t chEvtWaitOneTimeout(eventmask_t mask, systime_t time) { return IEvtWait(mask, time, true); }
+eventmask_t chEvtWaitAnyTimeout(eventmask_t mask, systime_t time) { return IEvtWait(mask, time, false); }
+#endif
+
+#if 1 // ==== Semaphores ====
+void chSemInit(Semaphore *sp, cnt_t n) {
+    chSysLock();
+    sp->Cnt = n;
+    sp->ResetGen = 0;
+    chSysUnlock();
+}
+
+void chSemReset(Semaphore *sp, cnt_t n) {
+    chSysLock();
+    sp->Cnt = n;
+    sp->ResetGen++;
+    IWakeAll();
+    chSysUnlock();
+}
+
+msg_t chSemWaitTimeout(Semaphore *sp, systime_t time) {
+    struct timespec Deadline;
+    if(time != TIME_INFINITE) IDeadline(time, &Deadline);
+    chSysLock();
+    uint32_t Gen = sp->ResetGen;
+    msg_t Rslt = RDY_OK;
+    while(sp->Cnt <= 0) {
+        if(time == TIME_IMMEDIATE or !ISleep((time == TIME_INFINITE)? nullptr : &Deadline)) {
+            if(sp->Cnt > 0) break;
+            Rslt = RDY_TIMEOUT;
+            break;
+        }
+        if(sp->ResetGen != Gen) {
+            Rslt = RDY_RESET;
+            break;
+        }
+    }
+    if(Rslt == RDY_OK) sp->Cnt--;
+    chSysUnlock();
+    return Rslt;
+}
+
+msg_t chSemWait(Semaphore *sp) { return chSemWaitTimeout(sp, TIME_INFINITE); }
+
+void chSemSignalI(Semaphore *sp) {
+    sp->Cnt++;
+    IWakeAll();
+}
+
+void chSemSignal(Semaphore *sp) {
+    chSysLock();
+    chSemSignalI(sp);
+    chSysUnlock();
+}
+#endif
+
+#if 1 // ==== Mailboxes ====
+void chMBInit(Mailbox *mbp, msg_t *buf, cnt_t n) {
+    mbp->PBuf = buf;
+    mbp->Sz = n;
+    mbp->Rd = mbp->Wr = mbp->Used = 0;
+}
+
+void chMBReset(Mailbox *mbp) {
+    chSysLock();
+    mbp->Rd = mbp->Wr = mbp->Used = 0;
+    IWakeAll();
+    chSysUnlock();
+}
+
+msg_t chMBPostI(Mailbox *mbp, msg_t msg) {
+    if(mbp->Used >= mbp->Sz) return RDY_TIMEOUT;
+    mbp->PBuf[mbp->Wr] = msg;
+    if(++mbp->Wr >= mbp->Sz) mbp->Wr = 0;
+    mbp->Used++;
+    IWakeAll();
+    return RDY_OK;
+}
+
+msg_t chMBPost(Mailbox *mbp, msg_t msg, systime_t timeout) {
+    struct timespec Deadline;
+    if(timeout != TIME_INFINITE) IDeadline(timeout, &Deadline);
+    chSysLock();
+    msg_t Rslt;
+    while((Rslt = chMBPostI(mbp, msg)) != RDY_OK) {
+        if(timeout == TIME_IMMEDIATE or !ISleep((timeout == TIME_INFINITE)? nullptr : &Deadline)) {
+            Rslt = chMBPostI(mbp, msg);
+            break;
+        }
+    }
+    chSysUnlock();
+    return Rslt;
+}
+
+msg_t chMBFetch(Mailbox *mbp, msg_t *msgp, systime_t timeout) {
+    struct timespec Deadline;
+    if(timeout != TIME_INFINITE) IDeadline(timeout, &Deadline);
+    chSysLock();
+    msg_t Rslt = RDY_OK;
+    while(mbp->Used == 0) {
+        if(timeout == TIME_IMMEDIATE or !ISleep((timeout == TIME_INFINITE)? nullptr : &Deadline)) {
+            if(mbp->Used == 0) Rslt = RDY_TIMEOUT;
+            break;
+        }
+    }
+    if(Rslt == RDY_OK) {
+        *msgp = mbp->PBuf[mbp->Rd];
+        if(++mbp->Rd >= mbp->Sz) mbp->Rd = 0;
+        mbp->Used--;
+        IWakeAll();
+    }
+    chSysUnlock();
+    return Rslt;
+}
+#endif
+
+#if 1 // ==== Host only ====
+void chHostWaitIdle() {
+    while(true) {
+        chSysLock();
+        Thread *Self = ISelf();
+        bool Idle = true;
+        for(Thread *p = PThreads; p != nullptr; p = p->Next) {
+            if(p == Self or p->Ended) continue;
+            if(!p->Waiting) { Idle = false; break; }
+        }
+        chSysUnlock();
+        if(Idle) return;
+        chThdSleep(1);
+    }
+}
+
+void chHostSetTimeScale(uint32_t Scale) {
+    pthread_once(&SysOnce, SysInit);
+    TimeScale = (Scale == 0)? 1 : Scale;
+}
+#endif
@@ -0,0 +1,138 @@
+/*
+ * ch.h
+ *
+ * Host stand-in for the part of ChibiOS/RT 2.6 kernel used by firmware code
+ * built in Tools/host. Threads are pthreads; system lock is one global mutex,
+ * every wait is done on one condition variable, which is broadcast on any change.
+ * Tick is 1 ms, as CH_FREQUENCY of firmware; it may be shortened by chHostSetTimeScale.
+ */
+
+#ifndef CH_H_
+#define CH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#ifndef __cplusplus
+#include <stdbool.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef TRUE
+#define TRUE    1
+#endif
+#ifndef FALSE
+#define FALSE   0
+#endif
+
+typedef bool        bool_t;
+typedef uint32_t    systime_t;
+typedef uint32_t    eventmask_t;
+typedef int32_t     msg_t;
+typedef int32_t     cnt_t;
+typedef uint32_t    tprio_t;
+typedef msg_t (*tfunc_t)(void *);
+typedef uint64_t    stkalign_t;
+
+#define CH_FREQUENCY        1000
+#define MS2ST(msec)         ((systime_t)(msec))
+#define S2ST(sec)           ((systime_t)((sec) * 1000))
+#define US2ST(usec)         ((systime_t)(((usec) + 999) / 1000))
+#define TIME_IMMEDIATE      ((systime_t)0)
+#define TIME_INFINITE       ((systime_t)-1)
+
+#define RDY_OK              0
+#define RDY_TIMEOUT         -1
+#define RDY_RESET           -2
+
+#define LOWPRIO             2
+#define NORMALPRIO          64
+#define HIGHPRIO            127
+#define THD_STATE_SUSPENDED 2
+
+#define EVENT_MASK(eid)     ((eventmask_t)(1 << (eid)))
+#define ALL_EVENTS          ((eventmask_t)-1)
+
+// Host threads have stacks of their own; working area is kept for sizeof() only
+#define WORKING_AREA(s, n)  stkalign_t s[1]
+
+#define CH_IRQ_HANDLER(id)  void id(void)
+#define CH_IRQ_PROLOGUE()
+#define CH_IRQ_EPILOGUE()
+
+typedef struct Thread Thread;
+
+typedef struct {
+    volatile cnt_t Cnt;
+    volatile uint32_t ResetGen;
+} Semaphore;
+
+typedef struct {
+    msg_t *PBuf;
+    cnt_t Sz;
+    volatile cnt_t Rd, Wr, Used;
+} Mailbox;
+
+#if 1 // ==== System ====
+void chSysLock(void);
+void chSysUnlock(void);
+#define chSysLockFromIsr()      chSysLock()
+#define chSysUnlockFromIsr()    chSysUnlock()
+systime_t chTimeNow(void);
+void *chHeapAlloc(void *heapp, size_t size);
+void chHeapFree(void *p);
+#endif
+
+#if 1 // ==== Threads ====
+Thread *chThdCreateStatic(void *wsp, size_t size, tprio_t prio, tfunc_t pf, void *arg);
+Thread *chThdSelf(void);
+void chRegSetThreadName(const char *name);
+void chThdSleep(systime_t time);
+#define chThdSleepMilliseconds(msec)    chThdSleep(MS2ST(msec))
+#define chThdSleepMicroseconds(usec)    chThdSleep(US2ST(usec))
+void chSchGoSleepS(int newstate);   // Forever on host
+#endif
+
+#if 1 // ==== Events ====
+void chEvtSignal(Thread *tp, eventmask_t mask);
+void chEvtSignalI(Thread *tp, eventmask_t mask);
+eventmask_t chEvtGetAndClearEvents(eventmask_t mask);
+eventmask_t chEvtWaitOne(eventmask_t mask);
+eventmask_t chEvtWaitAny(eventmask_t mask);
+eventmask_t chEvtWaitOneTimeout(eventmask_t mask, systime_t time);
+eventmask_t chEvtWaitAnyTimeout(eventmask_t mask, systime_t time);
+#endif
+
+#if 1 // ==== Semaphores ====
+void chSemInit(Semaphore *sp, cnt_t n);
+void chSemReset(Semaphore *sp, cnt_t n);
+msg_t chSemWait(Semaphore *sp);
+msg_t chSemWaitTimeout(Semaphore *sp, systime_t time);
+void chSemSignal(Semaphore *sp);
+void chSemSignalI(Semaphore *sp);
+#endif
+
+#if 1 // ==== Mailboxes ====
+void chMBInit(Mailbox *mbp, msg_t *buf, cnt_t n);
+void chMBReset(Mailbox *mbp);
+msg_t chMBPost(Mailbox *mbp, msg_t msg, systime_t timeout);
+msg_t chMBPostI(Mailbox *mbp, msg_t msg);
+msg_t chMBFetch(Mailbox *mbp, msg_t *msgp, systime_t timeout);
+#endif
+
+#if 1 // ==== Host only ====
+// Returns when every thread but caller waits for event, semaphore or mailbox
+// with nothing to wake it, i.e. all posted work is done.
+void chHostWaitIdle(void);
+// Kernel time runs Scale times faster than host clock, so that minutes of
+// poll schedule pass in seconds. To be called before any other kernel call.
+void chHostSetTimeScale(uint32_t Scale);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CH_H_ */
@@ -0,0 +1,35 @@
+/*
+ * cmd_uart.cpp
+ *
+ * Host stand-in for kl_lib/cmd_uart.cpp.
+ */
+
+#include "cmd_uart.h"
+#include <stdio.h>
+#include <stdarg.h>
+
+CmdUart_t Uart;
+
+static void FPutChar(char c) { putchar((c == '\r')? '\n' : c); }
+
+static void IVPrintf(const char *format, va_list args) {
+    flockfile(stdout);
+    kl_vsprintf(FPutChar, 99999, format, args);
+    funlockfile(stdout);
+}
+
+void CmdUart_t::Printf(const char *format, ...) {
+    if(Quiet) return;
+    va_list args;
+    va_start(args, format);
+    IVPrintf(format, args);
+    va_end(args);
+}
+
+void CmdUart_t::PrintfI(const char *format, ...) {
+    if(Quiet) return;
+    va_list args;
+    va_start(args, format);
+    IVPrintf(format, args);
+    va_end(args);
+}
@@ -0,0 +1,25 @@
+/*
+ * cmd_uart.h
+ *
+ * Host stand-in for kl_lib/cmd_uart.h: output goes to stdout through the same kl_vsprintf,
+ * '\r' becomes newline. Quiet drops output, to keep benchmark logs short.
+ */
+
+#ifndef CMD_UART_H_
+#define CMD_UART_H_
+
+#include "ch.h"
+#include "kl_lib_f2xx.h"
+#include "kl_sprintf.h"
+
+class CmdUart_t {
+public:
+    bool Quiet;
+    void Printf(const char *S, ...);
+    void PrintfI(const char *S, ...);
+    void Cmd(uint8_t CmdCode, uint8_t *PData, uint32_t Length) {}
+};
+
+extern CmdUart_t Uart;
+
+#endif /* CMD_UART_H_ */
@@ -0,0 +1,174 @@
+/*
+ * diskimg.c
+ *
+ * FatFs disk I/O and SDC driver of host build, see diskimg.h.
+ * Replaces sd/fatfs_diskio.c.
+ */
+
+#include "diskimg.h"
+#include "ch.h"
+#include "sdc.h"
+#include "ff.h"
+#include "diskio.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define SECTOR_SZ       512
+#define OK              0
+#define FAILURE         1
+
+DiskImgStats_t DiskImgStats;
+SDCDriver SDCD1;
+Semaphore semSDRW;
+
+static int IFd = -1;
+static uint32_t ISectorCnt;
+static bool IConnected;
+
+#if 1 // ==== Image ====
+static void PutU16(uint8_t *p, uint16_t v) { p[0] = v & 0xFF; p[1] = v >> 8; }
+static void PutU32(uint8_t *p, uint32_t v) { PutU16(p, v & 0xFFFF); PutU16(p + 2, v >> 16); }
+
+// FAT16 without partition table, as FatFs f_mkfs makes with SFD rule
+static uint8_t IFormat(uint32_t SectorCnt) {
+    const uint32_t SecPerClus = 4, RsvdCnt = 1, FatCnt = 2, RootEntCnt = 512;
+    const uint32_t RootSecCnt = RootEntCnt * 32 / SECTOR_SZ;
+    uint32_t FatSz = 1, ClusterCnt;
+    while(1) {
+        ClusterCnt = (SectorCnt - RsvdCnt - FatCnt * FatSz - RootSecCnt) / SecPerClus;
+        uint32_t Need = ((ClusterCnt + 2) * 2 + SECTOR_SZ - 1) / SECTOR_SZ;
+        if(Need <= FatSz) break;
+        FatSz = Need;
+    }
+    if(ClusterCnt < 4085 || ClusterCnt >= 65525) return FAILURE;
+
+    uint8_t Buf[SECTOR_SZ];
+    memset(Buf, 0, SECTOR_SZ);
+    memcpy(Buf, "\xEB\x3C\x90MSDOS5.0", 11);
+    PutU16(&Buf[11], SECTOR_SZ);
+    Buf[13] = SecPerClus;
+    PutU16(&Buf[14], RsvdCnt);
+    Buf[16] = FatCnt;
+    PutU16(&Buf[17], RootEntCnt);
+    if(SectorCnt < 0x10000) PutU16(&Buf[19], SectorCnt);
+    else PutU32(&Buf[32], SectorCnt);
+    Buf[21] = 0xF8;     // Fixed disk
+    PutU16(&Buf[22], FatSz);
+    PutU16(&Buf[24], 63);
+    PutU16(&Buf[26], 255);
+    Buf[36] = 0x80;
+    Buf[38] = 0x29;
+    PutU32(&Buf[39], 0x4C4E4643);
+    memcpy(&Buf[43], "NO NAME    FAT16   ", 19);
+    Buf[510] = 0x55;
+    Buf[511] = 0xAA;
+    if(pwrite(IFd, Buf, SECTOR_SZ, 0) != SECTOR_SZ) return FAILURE;
+
+    // FATs and root directory are zero in fresh image file, but first FAT entries
+    memset(Buf, 0, SECTOR_SZ);
+    memcpy(Buf, "\xF8\xFF\xFF\xFF", 4);
+    for(uint32_t i=0; i<FatCnt; i++) {
+        off_t Offset = (off_t)(RsvdCnt + i * FatSz) * SECTOR_SZ;
+        if(pwrite(IFd, Buf, SECTOR_SZ, Offset) != SECTOR_SZ) return FAILURE;
+    }
+    return OK;
+}
+
+uint8_t DiskImgCreate(const char *AFilename, uint32_t AMBytes) {
+    DiskImgClose();
+    IFd = open(AFilename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(IFd < 0) { perror(AFilename); return FAILURE; }
+    ISectorCnt = AMBytes * (1024 * 1024 / SECTOR_SZ);
+    if(ftruncate(IFd, (off_t)ISectorCnt * SECTOR_SZ) != 0 || IFormat(ISectorCnt) != OK) {
+        fprintf(stderr, "%s: cannot make volume\n", AFilename);
+        DiskImgClose();
+        return FAILURE;
+    }
+    return OK;
+}
+
+uint8_t DiskImgOpen(const char *AFilename) {
+    DiskImgClose();
+    IFd = open(AFilename, O_RDWR);
+    if(IFd < 0) { perror(AFilename); return FAILURE; }
+    off_t Sz = lseek(IFd, 0, SEEK_END);
+    ISectorCnt = (uint32_t)(Sz / SECTOR_SZ);
+    return OK;
+}
+
+void DiskImgClose() {
+    if(IFd >= 0) close(IFd);
+    IFd = -1;
+    ISectorCnt = 0;
+    IConnected = false;
+}
+#endif
+
+#if 1 // ==== SDC driver ====
+void sdcInit() {}
+void sdcStart(SDCDriver *sdcp, const void *config) { (void)config; sdcp->capacity = 0; }
+
+bool_t sdcConnect(SDCDriver *sdcp) {
+    if(IFd < 0) return TRUE;
+    sdcp->capacity = ISectorCnt;
+    IConnected = true;
+    return FALSE;
+}
+
+bool_t sdcDisconnect(SDCDriver *sdcp) {
+    (void)sdcp;
+    IConnected = false;
+    return FALSE;
+}
+#endif
+
+#if 1 // ==== FatFs disk I/O ====
+DSTATUS disk_initialize(BYTE drv) {
+    if(drv != 0) return STA_NODISK;
+    return IConnected? 0 : STA_NOINIT;
+}
+
+DSTATUS disk_status(BYTE drv) { return disk_initialize(drv); }
+
+DRESULT disk_read(BYTE drv, BYTE *buff, DWORD sector, BYTE count) {
+    if(drv != 0 || !IConnected) return RES_NOTRDY;
+    if(sector + count > ISectorCnt) return RES_PARERR;
+    ssize_t Sz = (ssize_t)count * SECTOR_SZ;
+    if(pread(IFd, buff, Sz, (off_t)sector * SECTOR_SZ) != Sz) return RES_ERROR;
+    DiskImgStats.ReadCmds++;
+    DiskImgStats.ReadSectors += count;
+    return RES_OK;
+}
+
+DRESULT disk_write(BYTE drv, const BYTE *buff, DWORD sector, BYTE count) {
+    if(drv != 0 || !IConnected) return RES_NOTRDY;
+    if(sector + count > ISectorCnt) return RES_PARERR;
+    ssize_t Sz = (ssize_t)count * SECTOR_SZ;
+    if(pwrite(IFd, buff, Sz, (off_t)sector * SECTOR_SZ) != Sz) return RES_ERROR;
+    DiskImgStats.WriteCmds++;
+    DiskImgStats.WriteSectors += count;
+    return RES_OK;
+}
+
+DRESULT disk_ioctl(BYTE drv, BYTE ctrl, void *buff) {
+    if(drv != 0) return RES_PARERR;
+    switch(ctrl) {
+        case CTRL_SYNC: return RES_OK;
+        case GET_SECTOR_COUNT: *((DWORD*)buff) = ISectorCnt; return RES_OK;
+        case GET_SECTOR_SIZE: *((WORD*)buff) = SECTOR_SZ; return RES_OK;
+        case GET_BLOCK_SIZE: *((DWORD*)buff) = 256; return RES_OK;
+        default: return RES_PARERR;
+    }
+}
+
+// Same fixed date as target without RTC
+DWORD get_fattime(void) {
+    uint32_t tics = chTimeNow();
+    uint32_t sec = (tics / 1000) % 60;
+    uint32_t min = (tics / (1000 * 60)) % 60;
+    uint32_t hour = (tics / (1000 * 60 * 60)) % 24;
+    return ((2015UL - 1980) << 25) | (1UL << 21) | (1UL << 16) | (hour << 11) | (min << 5) | (sec >> 1);
+}
+#endif
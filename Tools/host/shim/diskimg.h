@@ -0,0 +1,37 @@
+/*
+ * diskimg.h
+ *
+ * SD card of host build: FatFs disk I/O over image file, with counters of card commands.
+ * One multi-sector read or write is one command, as with SDIO driver of target.
+ */
+
+#ifndef DISKIMG_H_
+#define DISKIMG_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint32_t ReadCmds, ReadSectors;
+    uint32_t WriteCmds, WriteSectors;
+} DiskImgStats_t;
+
+extern DiskImgStats_t DiskImgStats;
+
+// Creates image of AMBytes (16...128) with empty FAT16 volume, and opens it
+uint8_t DiskImgCreate(const char *AFilename, uint32_t AMBytes);
+uint8_t DiskImgOpen(const char *AFilename);
+void DiskImgClose(void);
+static inline void DiskImgResetStats(void) {
+    DiskImgStats.ReadCmds = DiskImgStats.ReadSectors = 0;
+    DiskImgStats.WriteCmds = DiskImgStats.WriteSectors = 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DISKIMG_H_ */
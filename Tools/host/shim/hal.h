@@ -0,0 +1,39 @@
+/*
+ * hal.h
+ *
+ * Host stand-in for ChibiOS HAL: SDC driver, which is backed by disk image file,
+ * and DMA streams, which do nothing.
+ */
+
+#ifndef HAL_H_
+#define HAL_H_
+
+#include "ch.h"
+#include "sdc.h"
+
+#if 1 // ==== DMA ====
+// Streams exist for PnSpi_t to compile; host transports move bytes by themselves
+typedef struct stm32_dma_stream stm32_dma_stream_t;
+typedef void (*stm32_dmaisr_t)(void *p, uint32_t flags);
+#define STM32_DMA2_STREAM2      ((const stm32_dma_stream_t*)0)
+#define STM32_DMA2_STREAM5      ((const stm32_dma_stream_t*)0)
+
+#define STM32_DMA_CR_CHSEL(n)   ((uint32_t)(n) << 25)
+#define STM32_DMA_CR_PL(n)      ((uint32_t)(n) << 16)
+#define STM32_DMA_CR_MSIZE_BYTE 0
+#define STM32_DMA_CR_PSIZE_BYTE 0
+#define STM32_DMA_CR_MINC       (1UL << 10)
+#define STM32_DMA_CR_DIR_P2M    0
+#define STM32_DMA_CR_DIR_M2P    (1UL << 6)
+#define STM32_DMA_CR_TCIE       (1UL << 4)
+
+#define dmaStreamAllocate(dmastp, priority, func, param)    (false)
+#define dmaStreamSetPeripheral(dmastp, addr)                ((void)0)
+#define dmaStreamSetMemory0(dmastp, addr)                   ((void)0)
+#define dmaStreamSetTransactionSize(dmastp, size)           ((void)0)
+#define dmaStreamSetMode(dmastp, mode)                      ((void)0)
+#define dmaStreamEnable(dmastp)                             ((void)0)
+#define dmaStreamDisable(dmastp)                            ((void)0)
+#endif
+
+#endif /* HAL_H_ */
@@ -0,0 +1,29 @@
+/*
+ * integer.h
+ *
+ * FatFs types of fixed width. sd/integer.h takes DWORD as unsigned long, which is
+ * 64 bit on host, so this one is included first (-include) and takes its guard.
+ */
+
+#ifndef _INTEGER
+#define _INTEGER
+
+#include <stdint.h>
+
+typedef int             INT;
+typedef unsigned int    UINT;
+
+typedef char            CHAR;
+typedef unsigned char   UCHAR;
+typedef unsigned char   BYTE;
+
+typedef int16_t         SHORT;
+typedef uint16_t        USHORT;
+typedef uint16_t        WORD;
+typedef uint16_t        WCHAR;
+
+typedef int32_t         LONG;
+typedef uint32_t        ULONG;
+typedef uint32_t        DWORD;
+
+#endif
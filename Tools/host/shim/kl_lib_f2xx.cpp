@@ -0,0 +1,31 @@
+/*
+ * kl_lib_f2xx.cpp
+ *
+ * Host stand-in for kl_lib/kl_lib_f2xx.cpp.
+ */
+
+#include "kl_lib_f2xx.h"
+
+GPIO_TypeDef HostGpio[5];
+SPI_TypeDef HostSpi[3];
+TIM_TypeDef HostTim[14];
+
+// ================================= Random ====================================
+uint32_t Random(uint32_t TopValue) { return (uint32_t)rand() % (TopValue + 1); }
+
+// =================================== CRC =====================================
+static const uint32_t Crc32Table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+uint32_t Crc32(const void *PData, uint32_t ALength, uint32_t ACrc) {
+    const uint8_t *p = (const uint8_t*)PData;
+    uint32_t Crc = ~ACrc;
+    while(ALength--) {
+        Crc ^= *p++;
+        Crc = (Crc >> 4) ^ Crc32Table[Crc & 0x0F];
+        Crc = (Crc >> 4) ^ Crc32Table[Crc & 0x0F];
+    }
+    return ~Crc;
+}
@@ -0,0 +1,203 @@
+/*
+ * kl_lib_f2xx.h
+ *
+ * Host stand-in for kl_lib/kl_lib_f2xx.h: general definitions are the same,
+ * pins and peripherals are no-ops, Random and Crc32 are in kl_lib_f2xx.cpp.
+ */
+
+#ifndef KL_LIB_F2XX_H_
+#define KL_LIB_F2XX_H_
+
+#include <stdint.h>
+#include "ch.h"
+#include "hal.h"
+#include "string.h"     // for memcpy
+#include <cstdlib>      // for strtoul
+
+#if 1 // ============================ General ==================================
+#define PACKED __attribute__ ((__packed__))
+#ifndef countof
+#define countof(A)  (sizeof(A)/sizeof(A[0]))
+#endif
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+// Functional type
+typedef void (*ftVoidVoid)(void);
+typedef void (*ftVoidPVoid)(void*p);
+
+// Return values
+#define OK              0
+#define FAILURE         1
+#define TIMEOUT         2
+#define BUSY            3
+#define NEW             4
+#define IN_PROGRESS     5
+#define LAST            6
+#define CMD_ERROR       7
+#define WRITE_PROTECT   8
+#define CMD_UNKNOWN     9
+#define EMPTY_STRING    10
+#define NOT_A_NUMBER    11
+
+// Binary semaphores
+#define NOT_TAKEN       false
+#define TAKEN           true
+
+enum BitOrder_t {boMSB, boLSB};
+enum LowHigh_t  {Low, High};
+enum RiseFall_t {Rising, Falling, RisingFalling, NoRiseNoFall};
+
+// Simple pseudofunctions
+#define MIN(a, b)   ( ((a)<(b))? (a) : (b) )
+#define MAX(a, b)   ( ((a)>(b))? (a) : (b) )
+#define TRIM_VALUE(v, Max)  { if(v > Max) v = Max; }
+#define IS_LIKE(v, precise, deviation)  (((precise - deviation) < v) and (v < (precise + deviation)))
+
+#define ANY_OF_2(a, b1, b2)             (((a)==(b1)) or ((a)==(b2)))
+#define ANY_OF_3(a, b1, b2, b3)         (((a)==(b1)) or ((a)==(b2)) or ((a)==(b3)))
+#define ANY_OF_4(a, b1, b2, b3, b4)     (((a)==(b1)) or ((a)==(b2)) or ((a)==(b3)) or ((a)==(b4)))
+
+static inline uint16_t BuildUint16(uint8_t Lo, uint8_t Hi) { return (uint16_t)((Hi << 8) | Lo); }
+static inline uint32_t BuildUint32(uint8_t Lo, uint8_t MidLo, uint8_t MidHi, uint8_t Hi) {
+    return ((uint32_t)Hi << 24) | ((uint32_t)MidHi << 16) | ((uint32_t)MidLo << 8) | Lo;
+}
+
+// DMA
+#define DMA_PRIORITY_LOW        STM32_DMA_CR_PL(0b00)
+#define DMA_PRIORITY_MEDIUM     STM32_DMA_CR_PL(0b01)
+#define DMA_PRIORITY_HIGH       STM32_DMA_CR_PL(0b10)
+#define DMA_PRIORITY_VERYHIGH   STM32_DMA_CR_PL(0b11)
+
+// IRQ priorities
+#define IRQ_PRIO_LOW            15  // Minimum
+#define IRQ_PRIO_MEDIUM         9
+#define IRQ_PRIO_HIGH           7
+#define IRQ_PRIO_VERYHIGH       4 // Higher than systick
+#endif
+
+#if 1 // =========================== Time ======================================
+static inline bool TimeElapsed(systime_t *PSince, uint32_t Delay_ms) {
+    chSysLock();
+    bool Rslt = (systime_t)(chTimeNow() - *PSince) > MS2ST(Delay_ms);
+    if(Rslt) *PSince = chTimeNow();
+    chSysUnlock();
+    return Rslt;
+}
+#endif
+
+#if 1 // ================== Single pin manipulations ===========================
+// No ports on host: pins exist for the code to compile
+typedef struct { uint32_t ODR; } GPIO_TypeDef;
+extern GPIO_TypeDef HostGpio[5];
+#define GPIOA   (&HostGpio[0])
+#define GPIOB   (&HostGpio[1])
+#define GPIOC   (&HostGpio[2])
+#define GPIOD   (&HostGpio[3])
+#define GPIOE   (&HostGpio[4])
+
+enum PinOutMode_t {
+    omPushPull  = 0,
+    omOpenDrain = 1
+};
+enum PinPullUpDown_t {
+    pudNone = 0b00,
+    pudPullUp = 0b01,
+    pudPullDown = 0b10
+};
+enum PinSpeed_t {
+    ps2MHz  = 0b00,
+    ps25MHz = 0b01,
+    ps50MHz = 0b10,
+    ps100MHz = 0b11
+};
+enum PinAF_t {
+    AF0=0, AF1=1, AF2=2, AF3=3, AF4=4, AF5=5, AF6=6, AF7=7,
+    AF8=8, AF9=9,AF10=10, AF11=11, AF12=12, AF13=13, AF14=14, AF15=15
+};
+
+static inline void PinSet    (GPIO_TypeDef *PGpioPort, const uint16_t APinNumber) { PGpioPort->ODR |=  (uint32_t)(1<<APinNumber); }
+static inline void PinClear  (GPIO_TypeDef *PGpioPort, const uint16_t APinNumber) { PGpioPort->ODR &= ~(uint32_t)(1<<APinNumber); }
+static inline void PinToggle (GPIO_TypeDef *PGpioPort, const uint16_t APinNumber) { PGpioPort->ODR ^=  (uint32_t)(1<<APinNumber); }
+static inline bool PinIsSet  (GPIO_TypeDef *PGpioPort, const uint16_t APinNumber) { return (PGpioPort->ODR & (uint32_t)(1<<APinNumber)); }
+static inline void PinSetupOut(GPIO_TypeDef *PGpioPort, const uint16_t APinNumber, const PinOutMode_t PinOutMode,
+        const PinPullUpDown_t APullUpDown = pudNone, const PinSpeed_t ASpeed = ps50MHz) {}
+static inline void PinSetupIn(GPIO_TypeDef *PGpioPort, const uint16_t APinNumber, const PinPullUpDown_t APullUpDown) {}
+static inline void PinSetupAnalog(GPIO_TypeDef *PGpioPort, const uint16_t APinNumber) {}
+static inline void PinSetupAlterFunc(GPIO_TypeDef *PGpioPort, const uint16_t APinNumber, const PinOutMode_t PinOutMode,
+        const PinPullUpDown_t APullUpDown, const PinAF_t AAlterFunc, const PinSpeed_t ASpeed = ps50MHz) {}
+#endif
+
+#if 1 // ============================ Peripherals ================================
+// Registers firmware touches directly; nothing is behind them
+typedef struct { volatile uint32_t CR1, CR2, SR, DR; } SPI_TypeDef;
+typedef struct { volatile uint32_t CR1, ARR, CNT; } TIM_TypeDef;
+extern SPI_TypeDef HostSpi[3];
+extern TIM_TypeDef HostTim[14];
+#define SPI1    (&HostSpi[0])
+#define SPI2    (&HostSpi[1])
+#define SPI3    (&HostSpi[2])
+#define TIM6    (&HostTim[5])
+#define TIM7    (&HostTim[6])
+
+// ==== External IRQ ====
+enum ExtiTrigType_t {ttRising, ttFalling, ttRisingFalling};
+class IrqPin_t {
+public:
+    void Setup(GPIO_TypeDef *GPIO, const uint8_t APinNumber, ExtiTrigType_t ATriggerType) {}
+    void EnableIrq(const uint32_t Priority) {}
+    void DisableIrq() {}
+    void CleanIrqFlag() {}
+};
+
+// ==== Microsecond sleep ====
+class UsTimer_t {
+public:
+    void Init(TIM_TypeDef* Tmr) {}
+    void Sleep(uint32_t Us) { chThdSleepMicroseconds(Us); }
+};
+
+// ==== SPI ====
+enum CPHA_t {cphaFirstEdge, cphaSecondEdge};
+enum CPOL_t {cpolIdleLow, cpolIdleHigh};
+enum SpiBaudrate_t {
+    sbFdiv2   = 0b000,
+    sbFdiv4   = 0b001,
+    sbFdiv8   = 0b010,
+    sbFdiv16  = 0b011,
+    sbFdiv32  = 0b100,
+    sbFdiv64  = 0b101,
+    sbFdiv128 = 0b110,
+    sbFdiv256 = 0b111,
+};
+
+class Spi_t {
+public:
+    void Setup(SPI_TypeDef *Spi, BitOrder_t BitOrder, CPOL_t CPOL, CPHA_t CPHA, SpiBaudrate_t Baudrate) {}
+    void Enable () {}
+    void Disable() {}
+    uint8_t SetMaxFreq(uint32_t MaxFreqHz) { return OK; }
+    void ApplyClkChange() {}
+    void WaitBsyLo() {}
+    void ClearOVR() {}
+    void EnableTxDma()  {}
+    void EnableRxDma()  {}
+    void DisableTxDma() {}
+    void DisableRxDma() {}
+};
+#endif
+
+// ================================= Random ====================================
+uint32_t Random(uint32_t TopValue);
+
+// =================================== CRC =====================================
+// Same as on target: reflected polynomial 0xEDB88320, table of 16 entries
+uint32_t Crc32(const void *PData, uint32_t ALength, uint32_t ACrc = 0);
+
+#endif /* KL_LIB_F2XX_H_ */
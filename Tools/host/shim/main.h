@@ -0,0 +1,28 @@
+/*
+ * main.h
+ *
+ * Host stand-in for App of firmware, as much as pn.cpp needs: events go to
+ * the thread of PThd, which is the benchmark's own.
+ * Firmware sources next to the real main.h get that one; this is found only
+ * by sources copied to build dir.
+ */
+
+#ifndef MAIN_H_
+#define MAIN_H_
+
+#include "ch.h"
+#include "evt_mask.h"
+
+class App_t {
+public:
+    Thread *PThd;
+    void SendEvt(uint32_t EvtMsk) {
+        chSysLock();
+        chEvtSignalI(PThd, EvtMsk);
+        chSysUnlock();
+    }
+};
+
+extern App_t App;
+
+#endif /* MAIN_H_ */
@@ -0,0 +1,32 @@
+/*
+ * sdc.h
+ *
+ * Host stand-in for ChibiOS SDC driver. Card is the image file opened by DiskImgOpen,
+ * see diskimg.h.
+ */
+
+#ifndef SDC_H_
+#define SDC_H_
+
+#include "ch.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint32_t capacity;      // In sectors
+} SDCDriver;
+
+extern SDCDriver SDCD1;
+
+void sdcInit(void);
+void sdcStart(SDCDriver *sdcp, const void *config);
+bool_t sdcConnect(SDCDriver *sdcp);     // TRUE on error
+bool_t sdcDisconnect(SDCDriver *sdcp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SDC_H_ */
@@ -0,0 +1,23 @@
+/*
+ * sdc_lld.h
+ *
+ * Host stand-in for SDC low level driver: card detect callbacks, defined in kl_sd.cpp.
+ */
+
+#ifndef SDC_LLD_H_
+#define SDC_LLD_H_
+
+#include "sdc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bool_t sdc_lld_is_card_inserted(SDCDriver *sdcp);
+bool_t sdc_lld_is_write_protected(SDCDriver *sdcp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SDC_LLD_H_ */
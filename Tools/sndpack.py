@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+"""
+Sound clip packer for LockNFC.
+
+Packs mp3/wav files from subdirectories of SDCard folder into single file,
+which firmware opens once and plays by seek (see SndPackHdr_t in Soundlist.h).
+
+Layout, little endian:
+    Header:  Magic "SPAK", uint16 Version, uint16 ClipCnt, 8 bytes reserved
+    Table:   ClipCnt x (char Group[12], uint32 Offset, uint32 Length)
+    Clips:   each starts at 512-byte boundary, gaps are zero-filled
+
+Group is subdirectory name: GoodKey, BadKey, Closing, Secret.
+
+Usage:
+    sndpack.py SDCard                   -> SDCard/sounds.pak from all subdirs
+    sndpack.py SDCard GoodKey BadKey    -> only listed subdirs
+    sndpack.py SDCard -o out.pak
+"""
+
+import argparse
+import os
+import struct
+import sys
+
+MAGIC = b"SPAK"
+VERSION = 1
+GROUP_SZ = 12
+ALIGN = 512
+HDR_FMT = "<4sHH8x"
+ENTRY_FMT = "<%dsII" % GROUP_SZ
+EXTENSIONS = (".mp3", ".wav")
+
+
+def collect(root, groups):
+    if not groups:
+        groups = sorted(d for d in os.listdir(root) if os.path.isdir(os.path.join(root, d)))
+    clips = []
+    for group in groups:
+        name = group.encode("ascii")
+        if len(name) > GROUP_SZ:
+            sys.exit("%s: group name longer than %d chars" % (group, GROUP_SZ))
+        path = os.path.join(root, group)
+        for fname in sorted(os.listdir(path)):
+            fpath = os.path.join(path, fname)
+            if os.path.isfile(fpath) and fname.lower().endswith(EXTENSIONS):
+                clips.append((name, fpath))
+    return clips
+
+
+def align(n):
+    return (n + ALIGN - 1) // ALIGN * ALIGN
+
+
+def pack(clips, out):
+    if len(clips) > 0xFFFF:
+        sys.exit("Too many clips")
+    offset = align(struct.calcsize(HDR_FMT) + len(clips) * struct.calcsize(ENTRY_FMT))
+    table, data = [], []
+    for group, fpath in clips:
+        with open(fpath, "rb") as f:
+            body = f.read()
+        table.append(struct.pack(ENTRY_FMT, group, offset, len(body)))
+        data.append((offset, body))
+        offset = align(offset + len(body))
+    with open(out, "wb") as f:
+        f.write(struct.pack(HDR_FMT, MAGIC, VERSION, len(clips)))
+        f.write(b"".join(table))
+        for offset, body in data:
+            f.write(b"\0" * (offset - f.tell()))
+            f.write(body)
+    for (group, fpath), (offset, body) in zip(clips, data):
+        print("%-12s %8u %8u  %s" % (group.decode(), offset, len(body), fpath))
+    print("%s: %u clips, %u bytes" % (out, len(clips), os.path.getsize(out)))
+
+
+def main():
+    p = argparse.ArgumentParser(description="Pack sound clips into single file")
+    p.add_argument("root", help="folder with clip subdirs, e.g. SDCard")
+    p.add_argument("groups", nargs="*", help="subdirs to pack; all by default")
+    p.add_argument("-o", "--out", help="output file; root/sounds.pak by default")
+    a = p.parse_args()
+    clips = collect(a.root, a.groups)
+    if not clips:
+        sys.exit("Nothing to pack")
+    pack(clips, a.out or os.path.join(a.root, "sounds.pak"))
+
+
+if __name__ == "__main__":
+    main()